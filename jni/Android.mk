@@ -1,7 +1,7 @@
 LOCAL_PATH:= $(call my-dir)
 
 include $(CLEAR_VARS)
-LOCAL_SRC_FILES:= resetprop.cpp base.cpp persist.cpp
+LOCAL_SRC_FILES:= main.cpp resetprop.cpp base.cpp persist.cpp service.cpp audit.cpp
 LOCAL_MODULE:= resetprop
 LOCAL_LDLIBS           := -llog -landroid
 LOCAL_STATIC_LIBRARIES := libsystemproperties libnanopb
@@ -11,6 +11,16 @@ LOCAL_CFLAGS := -std=c++17
 
 include $(BUILD_EXECUTABLE)
 
+# 热点路径基准测试，持久化存储指向临时目录
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= bench.cpp resetprop.cpp base.cpp persist.cpp service.cpp audit.cpp
+LOCAL_MODULE:= resetprop_bench
+LOCAL_LDLIBS           := -llog -landroid
+LOCAL_STATIC_LIBRARIES := libsystemproperties libnanopb
+LOCAL_CFLAGS := -std=c++17 -DPERSIST_PROP_DIR='"/data/local/tmp/resetprop_bench"' \
+    -DAUDIT_FILE='"/data/local/tmp/resetprop_bench.audit"'
+include $(BUILD_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_MODULE:= libnanopb
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/nanopb
@@ -0,0 +1,200 @@
+// 属性修改审计环形缓冲区实现
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+
+#include "logging.h"
+#include "resetprop.hpp"
+
+using namespace std;
+
+// 所有resetprop进程共享同一个映射文件，文件存在即表示启用审计。
+// 写入者用fetch_add领取槽位，每个槽位按序列锁的方式写入，读取者丢弃正在写入的槽位
+#define AUDIT_MAGIC     0x31415052  // "RPA1"
+#define AUDIT_CAPACITY  512         // 保留的记录条数，必须是2的幂
+
+struct audit_header {
+    uint32_t magic;
+    uint32_t capacity;
+    atomic<uint64_t> head;  // 下一条记录的序号
+};
+
+// 每条记录512字节，过长的名称和值被截断
+struct audit_entry {
+    atomic<uint64_t> seq;  // 序号加1，0表示正在写入或为空
+    int64_t time_ns;       // CLOCK_REALTIME
+    int32_t pid;
+    uint8_t op;            // 0表示设置，1表示删除
+    uint8_t path;          // audit_path
+    uint16_t reserved;
+    char name[128];
+    char old_value[180];
+    char new_value[180];
+};
+static_assert(sizeof(audit_entry) == 512);
+
+static size_t audit_size(uint32_t capacity) {
+    return sizeof(audit_header) + (size_t) capacity * sizeof(audit_entry);
+}
+
+static mutex audit_lock;
+static atomic<audit_header *> audit_ring = nullptr;
+static size_t audit_ring_size = 0;
+static atomic_bool audit_checked = false;
+
+// 映射并检查审计文件，文件不存在或不合法时返回nullptr
+static audit_header *audit_open(size_t &size) {
+    int fd = open(AUDIT_FILE, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    struct stat st{};
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(audit_header))
+        p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+    auto h = static_cast<audit_header *>(p);
+    if (h->magic != AUDIT_MAGIC || (h->capacity & (h->capacity - 1)) ||
+        st.st_size != audit_size(h->capacity)) {
+        munmap(p, st.st_size);
+        return nullptr;
+    }
+    size = st.st_size;
+    return h;
+}
+
+// 映射审计文件，只在第一次使用或audit_enable之后检查；文件不存在时返回nullptr。
+// 可能在多个线程中同时调用，只有一个线程负责映射
+static audit_header *audit_map() {
+    if (audit_checked.load(memory_order_acquire))
+        return audit_ring.load(memory_order_relaxed);
+    lock_guard lock(audit_lock);
+    if (!audit_checked.load(memory_order_relaxed)) {
+        audit_ring.store(audit_open(audit_ring_size), memory_order_relaxed);
+        audit_checked.store(true, memory_order_release);
+    }
+    return audit_ring.load(memory_order_relaxed);
+}
+
+// 解除映射，之后重新检查审计文件
+static void audit_unmap() {
+    lock_guard lock(audit_lock);
+    if (auto h = audit_ring.exchange(nullptr, memory_order_relaxed))
+        munmap(h, audit_ring_size);
+    audit_checked.store(false, memory_order_release);
+}
+
+static audit_entry *audit_entries(audit_header *h) {
+    return reinterpret_cast<audit_entry *>(h + 1);
+}
+
+bool audit_enabled() {
+    return audit_map() != nullptr;
+}
+
+static void copy_field(char *dst, size_t size, const char *src) {
+    strscpy(dst, src ? src : "", size);
+}
+
+void audit_record(audit_path path, const char *name, const char *old_value, const char *new_value) {
+    auto h = audit_map();
+    if (h == nullptr)
+        return;
+    uint64_t seq = h->head.fetch_add(1, memory_order_relaxed);
+    auto &e = audit_entries(h)[seq & (h->capacity - 1)];
+
+    e.seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e.time_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    e.pid = getpid();
+    e.op = new_value ? 0 : 1;
+    e.path = (uint8_t) path;
+    copy_field(e.name, sizeof(e.name), name);
+    copy_field(e.old_value, sizeof(e.old_value), old_value);
+    copy_field(e.new_value, sizeof(e.new_value), new_value);
+    e.seq.store(seq + 1, memory_order_release);
+}
+
+// 创建或删除审计文件，当前进程立即开始或停止记录
+bool audit_enable(bool enable) {
+    audit_unmap();
+    if (!enable)
+        return unlink(AUDIT_FILE) == 0 || errno == ENOENT;
+    if (access(AUDIT_FILE, F_OK) == 0)
+        return true;
+
+    // 在临时文件中初始化后再rename，其他进程不会映射到未初始化的文件
+    char tmp[4096];
+    ssprintf(tmp, sizeof(tmp), "%s.XXXXXX", AUDIT_FILE);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    audit_header h{};
+    h.magic = AUDIT_MAGIC;
+    h.capacity = AUDIT_CAPACITY;
+    bool ok = ftruncate(fd, audit_size(AUDIT_CAPACITY)) == 0 &&
+              pwrite(fd, &h, sizeof(h), 0) == sizeof(h) &&
+              fchmod(fd, 0600) == 0;
+    close(fd);
+    if (!ok || rename(tmp, AUDIT_FILE) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+static const char *audit_path_name(uint8_t path) {
+    switch ((audit_path) path) {
+    case audit_path::direct: return "direct";
+    case audit_path::service: return "property_service";
+    case audit_path::persist: return "persist";
+    }
+    return "unknown";
+}
+
+// 按时间顺序输出审计记录，审计未启用时返回false
+bool audit_dump(FILE *out) {
+    auto h = audit_map();
+    if (h == nullptr)
+        return false;
+    uint64_t head = h->head.load(memory_order_acquire);
+    uint64_t start = head > h->capacity ? head - h->capacity : 0;
+    for (uint64_t seq = start; seq < head; ++seq) {
+        auto &src = audit_entries(h)[seq & (h->capacity - 1)];
+        // 先复制再检查序号，写入者在复制期间修改了这条记录时丢弃
+        uint64_t s = src.seq.load(memory_order_acquire);
+        if (s != seq + 1)
+            continue;
+        audit_entry e;
+        memcpy((char *) &e + sizeof(e.seq), (const char *) &src + sizeof(src.seq),
+               sizeof(e) - sizeof(e.seq));
+        atomic_thread_fence(memory_order_acquire);
+        if (src.seq.load(memory_order_relaxed) != s)
+            continue;
+        e.name[sizeof(e.name) - 1] = '\0';
+        e.old_value[sizeof(e.old_value) - 1] = '\0';
+        e.new_value[sizeof(e.new_value) - 1] = '\0';
+
+        time_t sec = e.time_ns / 1000000000;
+        tm t{};
+        localtime_r(&sec, &t);
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &t);
+        fprintf(out, "%s.%03d %5d %-16s ", date, (int) (e.time_ns / 1000000 % 1000), e.pid,
+                audit_path_name(e.path));
+        if (e.op == 0)
+            fprintf(out, "set [%s]: [%s] -> [%s]\n", e.name, e.old_value, e.new_value);
+        else
+            fprintf(out, "delete [%s]: [%s]\n", e.name, e.old_value);
+    }
+    return true;
+}
@@ -2,8 +2,12 @@
 #include <sys/sysmacros.h>
 #include <sys/mman.h>
 #include <sys/sendfile.h>
+#include <sys/file.h>
 #include <unistd.h>
 #include <string>
+#include <array>
+#include <vector>
+#include <mutex>
 
 #include "base.hpp"
 
@@ -101,11 +105,115 @@ mmap_data::mmap_data(const char *name, bool rw) {
     }
 }
 
+// 映射已打开的文件描述符
+mmap_data::mmap_data(int fd, size_t sz, bool rw) {
+    init(fd, sz, rw);
+}
+
+// 小文件读取使用的缓冲池，缓冲区大小固定为IO_READ_MAX
+static mutex pool_lock;
+static vector<uint8_t *> pool;
+#define IO_POOL_MAX 4
+
+static uint8_t *pool_get() {
+    {
+        lock_guard lock(pool_lock);
+        if (!pool.empty()) {
+            auto buf = pool.back();
+            pool.pop_back();
+            return buf;
+        }
+    }
+    return static_cast<uint8_t *>(malloc(IO_READ_MAX));
+}
+
+static void pool_put(uint8_t *buf) {
+    {
+        lock_guard lock(pool_lock);
+        if (pool.size() < IO_POOL_MAX) {
+            pool.push_back(buf);
+            return;
+        }
+    }
+    free(buf);
+}
 
-// 析构函数，释放内存映射
+// 按策略读取或映射文件
+void mmap_data::init(int fd, size_t sz, io_mode mode) {
+    if (sz == 0)
+        return;
+    if (mode == io_mode::automatic) {
+        mode = sz <= IO_READ_MAX ? io_mode::read : io_mode::map;
+    }
+
+    if (mode == io_mode::read) {
+        _backing = sz <= IO_READ_MAX ? backing::pool : backing::heap;
+        _buf = _backing == backing::pool ? pool_get() : static_cast<uint8_t *>(malloc(sz));
+        size_t off = 0;
+        for (ssize_t n; _buf && off < sz; off += n) {
+            if ((n = pread(fd, _buf + off, sz - off, off)) <= 0)
+                break;
+        }
+        _sz = off;
+        return;
+    }
+
+    int flags = MAP_PRIVATE | (mode == io_mode::populate ? MAP_POPULATE : 0);
+    void *b = mmap(nullptr, sz, PROT_READ, flags, fd, 0);
+    if (b == MAP_FAILED)
+        return;
+    if (mode == io_mode::map)
+        madvise(b, sz, MADV_SEQUENTIAL);
+    _buf = static_cast<uint8_t *>(b);
+    _sz = sz;
+}
+
+// 以指定策略只读访问文件描述符
+mmap_data::mmap_data(int fd, size_t sz, io_mode mode) {
+    init(fd, sz, mode);
+}
+
+// 以指定策略只读访问文件
+mmap_data::mmap_data(const char *name, io_mode mode) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    run_finally g([=] { close(fd); });
+    struct stat st{};
+    if (fstat(fd, &st))
+        return;
+    init(fd, st.st_size, mode);
+}
+
+// 获取锁文件的独占锁，必要时创建锁文件
+file_lock::file_lock(const char *path) : fd(open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) {
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+// 关闭锁文件即释放锁
+file_lock::~file_lock() {
+    if (fd >= 0)
+        close(fd);
+}
+
+// 析构函数，释放内存映射或缓冲区
 mmap_data::~mmap_data() {
-    if (_buf)
+    if (!_buf)
+        return;
+    switch (_backing) {
+    case backing::map:
         munmap(_buf, _sz);
+        break;
+    case backing::pool:
+        pool_put(_buf);
+        break;
+    case backing::heap:
+        free(_buf);
+        break;
+    }
 }
 
 // 来源：https://github.com/topjohnwu/Magisk/blob/15e13a8d8bb61ed896df94881d63903cbfcc516b/native/src/base/misc.cpp#L273
@@ -127,6 +235,25 @@ int ssprintf(char *dest, size_t size, const char *fmt, ...) {
     return r;
 }
 
+// 计算CRC32校验和（IEEE 802.3多项式）
+uint32_t crc32_ieee(const void *buf, size_t len, uint32_t crc) {
+    static const auto table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    auto p = static_cast<const uint8_t *>(buf);
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
 #include <sys/syscall.h>
 #include <sys/xattr.h>
 
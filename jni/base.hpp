@@ -8,11 +8,17 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
 
 // 解析属性文件的函数声明
 void parse_prop_file(const char *file, const function<bool(string_view, string_view)> &fn);
+void parse_prop_file(FILE *fp, const function<bool(string_view, string_view)> &fn);
 
 // 仅允许移动的类宏定义（禁用拷贝构造）
 #define ALLOW_MOVE_ONLY(clazz) \
@@ -113,17 +119,105 @@ private:
     Func fn;
 };
 
+// 基于flock的跨进程建议锁，析构时释放
+struct file_lock {
+    DISALLOW_COPY_AND_MOVE(file_lock)
+    explicit file_lock(const char *path);
+    ~file_lock();
+    bool locked() const { return fd >= 0; }
+private:
+    int fd;
+};
+
+// 单生产者单消费者的有界无锁队列，容量N必须是2的幂。
+// 队列满或空时先自旋，再逐步退避到睡眠，一端阻塞在I/O上时另一端不会长时间占用CPU
+template <class T, size_t N>
+struct spsc_queue {
+    static_assert(N && (N & (N - 1)) == 0);
+
+    // 生产者调用，队列满时等待
+    void push(T &&v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        for (int spins = 0; t - head.load(std::memory_order_acquire) == N;)
+            backoff(spins);
+        slots[t & (N - 1)] = std::move(v);
+        tail.store(t + 1, std::memory_order_release);
+    }
+    // 生产者调用，表示不会再有新的元素
+    void close() { closed.store(true, std::memory_order_release); }
+
+    // 消费者调用，队列为空时立即返回false
+    bool try_pop(T &v) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        v = std::move(slots[h & (N - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    // 消费者调用，队列为空时等待；生产者已关闭且队列为空时返回false
+    bool pop(T &v) {
+        for (int spins = 0;; backoff(spins)) {
+            if (try_pop(v))
+                return true;
+            if (closed.load(std::memory_order_acquire))
+                return try_pop(v);
+        }
+    }
+private:
+    static void backoff(int &spins) {
+        if (++spins <= 64)
+            return;
+        if (spins <= 128) {
+            std::this_thread::yield();
+            return;
+        }
+        spins = std::min(spins, 1024);
+        usleep(spins < 1024 ? 50 : 1000);
+    }
+
+    alignas(64) std::atomic_size_t head{0};
+    alignas(64) std::atomic_size_t tail{0};
+    std::atomic_bool closed{false};
+    T slots[N];
+};
+
+// 只读访问时的I/O策略分界点，由resetprop_bench的io_*测试确定：
+// 页缓存中的文件在128K以内pread比映射快一倍以上，256K时两者持平。
+// MAP_POPULATE在4K到16M的各个大小上都没有稳定优于MADV_SEQUENTIAL，因此不会自动选择
+#define IO_READ_MAX  (128 * 1024)  // 不超过此大小时读入缓冲池
+
 // 内存映射数据类，继承自byte_data，用于文件映射操作
 struct mmap_data : public byte_data {
     static_assert((sizeof(void *) == 8 && BLKGETSIZE64 == 0x80081272) ||
                   (sizeof(void *) == 4 && BLKGETSIZE64 == 0x80041272));
     ALLOW_MOVE_ONLY(mmap_data)
 
+    // 只读访问的I/O策略
+    enum class io_mode : uint8_t {
+        automatic,  // 根据文件大小选择read或map
+        read,       // 读入缓冲池中的缓冲区
+        map,        // 只读映射，MADV_SEQUENTIAL
+        populate,   // 只读映射，MAP_POPULATE
+    };
+
     explicit mmap_data(const char *name, bool rw = false);
     mmap_data(int fd, size_t sz, bool rw = false);
+    // 只读访问，数据不可修改
+    mmap_data(const char *name, io_mode mode);
+    mmap_data(int fd, size_t sz, io_mode mode);
     ~mmap_data();
+
+    void swap(mmap_data &o) {
+        byte_data::swap(o);
+        std::swap(_backing, o._backing);
+    }
 private:
+    enum class backing : uint8_t { map, pool, heap };
+    backing _backing = backing::map;
+
     void init(int fd, size_t sz, bool rw);
+    void init(int fd, size_t sz, io_mode mode);
 };
 
 // 字符串格式化和操作函数
@@ -131,6 +225,9 @@ int ssprintf(char *dest, size_t size, const char *fmt, ...);        // 安全的
 size_t strscpy(char *dest, const char *src, size_t size);           // 安全的字符串复制
 int vssprintf(char *dest, size_t size, const char *fmt, va_list ap); // 变长参数版本的sprintf
 
+// 计算CRC32校验和（IEEE 802.3多项式），crc为上一段数据的结果
+uint32_t crc32_ieee(const void *buf, size_t len, uint32_t crc = 0);
+
 // 文件属性结构体，包含文件状态和SELinux上下文
 struct file_attr {
     struct stat st;      // 文件状态信息
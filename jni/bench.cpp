@@ -0,0 +1,805 @@
+// resetprop热点路径的基准测试
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <new>
+#include <thread>
+#include <atomic>
+
+#include "resetprop_impl.hpp"
+
+#include <system_properties/prop_info.h>
+
+#ifndef PERSIST_PROP_DIR
+#define PERSIST_PROP_DIR "/data/local/tmp/resetprop_bench"
+#endif
+#define BENCH_STORE     PERSIST_PROP_DIR "/persistent_properties"
+#define BENCH_PROP_FILE PERSIST_PROP_DIR "/bench.prop"
+#define BENCH_AREA      PERSIST_PROP_DIR "/__properties__"
+#define PROP_AREA_DIR   "/dev/__properties__"
+#define BENCH_MIN_TIME  200ms   // 每项测试至少运行的时间
+#define BENCH_REGRESS   1.20    // 超过基线20%视为退化
+
+using namespace std;
+using namespace std::chrono;
+
+// 统计operator new的调用次数
+static atomic_size_t alloc_count = 0;
+
+void *operator new(size_t sz) {
+    ++alloc_count;
+    if (void *p = malloc(sz ?: 1))
+        return p;
+    abort();
+}
+void *operator new[](size_t sz) { return operator new(sz); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+struct bench_result {
+    string name;
+    double ns_op;
+    double allocs_op;
+    long peak_rss_kb;
+};
+
+static vector<bench_result> results;
+static const char *bench_filter = nullptr;  // 只运行名称包含此字符串的测试
+
+// 将进程的峰值RSS（VmHWM）重置为当前RSS，需要Linux 4.0及以上
+static bool reset_peak_rss() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, "5", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+static long peak_rss_kb() {
+    auto fp = open_file("/proc/self/status", "re");
+    if (!fp)
+        return -1;
+    char line[256];
+    long kb;
+    while (fgets(line, sizeof(line), fp.get())) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            return kb;
+    }
+    return -1;
+}
+
+// 重复运行fn直到超过最短时间，每次调用fn完成ops次操作。
+// 峰值RSS在每项测试开始前重置，只反映这项测试（包括进程中已有的内存）；无法重置时为-1
+template<class Fn>
+static void run_bench(string name, size_t ops, Fn &&fn) {
+    if (bench_filter && !str_contains(name, bench_filter))
+        return;
+    bool peak = reset_peak_rss();
+    fn();  // 预热
+    size_t reps = 0;
+    size_t allocs = alloc_count;
+    auto start = steady_clock::now();
+    auto elapsed = steady_clock::duration::zero();
+    do {
+        fn();
+        ++reps;
+        elapsed = steady_clock::now() - start;
+    } while (elapsed < BENCH_MIN_TIME || reps < 3);
+    allocs = alloc_count - allocs;
+
+    double total = (double) reps * ops;
+    results.push_back({ std::move(name), duration<double, nano>(elapsed).count() / total,
+                        allocs / total, peak ? peak_rss_kb() : -1 });
+    auto &r = results.back();
+    printf("%-28s %12.1f ns/op %10.2f allocs/op %8ld KiB peak\n",
+           r.name.data(), r.ns_op, r.allocs_op, r.peak_rss_kb);
+    fflush(stdout);
+}
+
+// 在子进程中运行一组测试，结果通过管道传回。
+// 存储格式在进程内第一次访问时确定，使用传统格式的测试必须在独立的进程中运行
+static void run_in_child(void (*fn)()) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        return;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        results.clear();
+        fn();
+        for (auto &r : results)
+            dprintf(fds[1], "%s %f %f %ld\n", r.name.data(), r.ns_op, r.allocs_op, r.peak_rss_kb);
+        _exit(0);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return;
+    }
+    if (auto fp = make_file(fdopen(fds[0], "re"))) {
+        char line[256], name[128];
+        bench_result r;
+        while (fgets(line, sizeof(line), fp.get())) {
+            if (sscanf(line, "%127s %lf %lf %ld", name, &r.ns_op, &r.allocs_op, &r.peak_rss_kb) == 4) {
+                r.name = name;
+                results.push_back(r);
+            }
+        }
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+static int failed_checks = 0;
+
+// 正确性检查，任何一项失败时以非零状态退出
+static void check(const char *name, bool ok) {
+    printf("%-28s %s\n", name, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    if (!ok)
+        ++failed_checks;
+}
+
+// 生成第i个合成属性
+static string bench_name(size_t i) {
+    char buf[64];
+    ssprintf(buf, sizeof(buf), "persist.bench.module%zu.key%zu", i % 97, i);
+    return buf;
+}
+
+static string bench_value(size_t i) {
+    char buf[64];
+    ssprintf(buf, sizeof(buf), "value-%zu-%08zx", i, i * 2654435761u);
+    return buf;
+}
+
+// 将持久化存储重置为n个合成属性。
+// 在子进程中生成，避免夹具占用的内存计入后续测试的峰值RSS
+static void reset_store(size_t n) {
+    close(open(BENCH_STORE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+    unlink(BENCH_STORE ".journal");
+    if (n == 0)
+        return;
+    pid_t pid = fork();
+    if (pid == 0) {
+        persist_batch batch;
+        for (size_t i = 0; i < n; ++i)
+            batch.emplace_back(bench_name(i), bench_value(i));
+        _exit(persist_apply(batch) ? 0 : 1);
+    }
+    if (pid > 0)
+        waitpid(pid, nullptr, 0);
+}
+
+struct count_cb : prop_cb {
+    void exec(const char *, const char *) override { ++n; }
+    size_t n = 0;
+};
+
+static void bench_parse() {
+    constexpr size_t lines = 100000;
+    {
+        auto fp = open_file(BENCH_PROP_FILE, "we");
+        if (!fp) return;
+        for (size_t i = 0; i < lines; ++i) {
+            if (i % 10 == 0)
+                fprintf(fp.get(), "# comment %zu\n", i);
+            fprintf(fp.get(), "%s=%s\n", bench_name(i).data(), bench_value(i).data());
+        }
+    }
+    run_bench("parse_prop_file/100k", lines, [] {
+        size_t n = 0;
+        parse_prop_file(BENCH_PROP_FILE, [&](auto, auto) -> bool { ++n; return true; });
+    });
+    unlink(BENCH_PROP_FILE);
+}
+
+// 从管道和大文件读取属性并生成修改计划：逐行串行处理与解析、设置重叠的流水线对比。
+// 生成计划只读取属性区域，不做任何修改
+static void bench_stream() {
+    constexpr size_t lines = 100000;
+    string input;
+    for (size_t i = 0; i < lines; ++i)
+        input += bench_name(i) + "=" + bench_value(i) + "\n";
+    {
+        auto fp = open_file(BENCH_PROP_FILE, "we");
+        if (!fp) return;
+        fwrite(input.data(), 1, input.size(), fp.get());
+    }
+
+    // 在单独的线程中写入管道，模拟由其他进程产生的输入
+    auto with_pipe = [&](const function<void(FILE *)> &fn) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC))
+            return;
+        thread writer([&] {
+            for (size_t off = 0; off < input.size();) {
+                ssize_t n = write(fds[1], input.data() + off, min<size_t>(input.size() - off, 4096));
+                if (n <= 0) break;
+                off += n;
+            }
+            close(fds[1]);
+        });
+        auto fp = make_file(fdopen(fds[0], "re"));
+        fn(fp.get());
+        writer.join();
+    };
+
+    // 页缓存中的大文件，与-f FILE读取的输入相同
+    auto with_file = [&](const function<void(FILE *)> &fn) {
+        auto fp = open_file(BENCH_PROP_FILE, "re");
+        fn(fp.get());
+    };
+
+    PropFlags flags;
+    auto serial = [&](FILE *fp) {
+        parse_prop_file(fp, [&](string_view key, string_view val) -> bool {
+            if (!check_prop_name(key) && !check_prop_value(key, val))
+                plan_prop(string(key), string(val), flags, nullptr, true);
+            return true;
+        });
+    };
+    auto stream = [&](FILE *fp) {
+        vector<prop_error> errors;
+        stream_props(fp, [&](stream_record &r) {
+            plan_prop(std::move(r.name), std::move(r.value), flags, nullptr, true);
+        }, nullptr, errors);
+    };
+    run_bench("serial_pipe/100k", lines, [&] { with_pipe(serial); });
+    run_bench("stream_pipe/100k", lines, [&] { with_pipe(stream); });
+    run_bench("serial_file/100k", lines, [&] { with_file(serial); });
+    run_bench("stream_file/100k", lines, [&] { with_file(stream); });
+    unlink(BENCH_PROP_FILE);
+}
+
+static void bench_check_name() {
+    constexpr size_t count = 10000;
+    vector<string> names;
+    for (size_t i = 0; i < count; ++i)
+        names.push_back(bench_name(i));
+    run_bench("check_legal_property_name", count, [&] {
+        for (auto &name : names) {
+            if (!check_legal_property_name(name.data()))
+                abort();
+        }
+    });
+}
+
+static void bench_persist() {
+    for (size_t n : { 100, 10000, 100000 }) {
+        persist_batch batch;
+        for (size_t i = 0; i < n; ++i)
+            batch.emplace_back(bench_name(i), bench_value(i));
+        run_bench("persist_apply/" + to_string(n), n, [&] {
+            close(open(BENCH_STORE, O_WRONLY | O_TRUNC | O_CLOEXEC));
+            persist_apply(batch);
+        });
+        run_bench("pb_decode/" + to_string(n), n, [] {
+            count_cb cb;
+            persist_get_props(&cb);
+        });
+    }
+
+    for (size_t n : { 10000, 100000 }) {
+        reset_store(n);
+        size_t i = 0;
+        run_bench("persist_set_prop/" + to_string(n), 1, [&] {
+            persist_set_prop("persist.bench.set", bench_value(i++).data());
+        });
+    }
+}
+
+#define CONCURRENT_SETS  64  // 每个写入进程设置的属性数
+
+static string concurrent_name(int proc, int i) {
+    char buf[64];
+    ssprintf(buf, sizeof(buf), "persist.bench.proc%d.key%d", proc, i);
+    return buf;
+}
+
+// procs个进程同时逐个设置各自的属性，全部成功时返回true
+static bool persist_concurrent(int procs) {
+    vector<pid_t> pids;
+    for (int p = 0; p < procs; ++p) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            bool ok = true;
+            for (int i = 0; i < CONCURRENT_SETS; ++i)
+                ok &= persist_set_prop(concurrent_name(p, i).data(), bench_value(i).data());
+            _exit(ok ? 0 : 1);
+        }
+        if (pid > 0)
+            pids.push_back(pid);
+    }
+    bool ok = pids.size() == (size_t) procs;
+    for (pid_t pid : pids) {
+        int status;
+        ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return ok;
+}
+
+// 并发写入不丢失更新：直接提交和日志模式下，所有进程的所有属性都必须存在且值正确
+static void check_persist_concurrent() {
+    constexpr int procs = 8;
+    for (bool journal : { false, true }) {
+        reset_store(0);
+        persist_use_journal(journal);
+        bool ok = persist_concurrent(procs) && persist_compact();
+        persist_use_journal(false);
+
+        prop_list list;
+        prop_collector collector(list);
+        persist_get_props(&collector);
+        ok &= list.size() == procs * CONCURRENT_SETS;
+        for (int p = 0; p < procs; ++p) {
+            for (int i = 0; i < CONCURRENT_SETS; ++i) {
+                auto it = list.find(concurrent_name(p, i));
+                ok &= it != list.end() && it->second == bench_value(i);
+            }
+        }
+        check(journal ? "persist_concurrent/journal" : "persist_concurrent", ok);
+    }
+}
+
+// 日志头失效后（init重写了存储文件），init修改过的属性以init为准，
+// 其他属性的日志记录照常生效，读取和提交的结果相同
+static void check_persist_stale_journal() {
+    reset_store(0);
+    persist_use_journal(true);
+    bool ok = persist_set_prop("persist.bench.stale.x", "A") &&
+              persist_set_prop("persist.bench.stale.y", "1");
+    // 模拟init重写存储文件：暂时移开日志，直接提交x=B
+    persist_use_journal(false);
+    ok &= rename(BENCH_STORE ".journal", BENCH_STORE ".journal.saved") == 0 &&
+          persist_set_prop("persist.bench.stale.x", "B") &&
+          rename(BENCH_STORE ".journal.saved", BENCH_STORE ".journal") == 0;
+
+    auto verify = [] {
+        prop_list list;
+        prop_collector collector(list);
+        persist_get_props(&collector);
+        return list["persist.bench.stale.x"] == "B" && list["persist.bench.stale.y"] == "1";
+    };
+    ok &= verify();
+    ok &= persist_compact() && access(BENCH_STORE ".journal", F_OK) != 0 && verify();
+    check("persist_stale_journal", ok);
+
+    // 提交在两次rename之间崩溃：新存储文件只合并了x=A，旧日志中还有编码期间追加的x=C
+    reset_store(0);
+    persist_use_journal(true);
+    ok = persist_set_prop("persist.bench.stale.x", "A") &&
+         persist_set_prop("persist.bench.stale.x", "C") &&
+         rename(BENCH_STORE ".journal", BENCH_STORE ".journal.saved") == 0;
+    persist_use_journal(false);
+    ok &= persist_set_prop("persist.bench.stale.x", "A") &&
+          rename(BENCH_STORE ".journal.saved", BENCH_STORE ".journal") == 0;
+    auto value = [] {
+        prop_list list;
+        prop_collector collector(list);
+        persist_get_props(&collector);
+        return list["persist.bench.stale.x"];
+    };
+    ok &= value() == "C" && persist_compact() && value() == "C";
+    check("persist_stale_journal/crash", ok);
+}
+
+// 写入吞吐量随并发进程数的变化，ns/op为所有进程的总耗时除以总写入数
+static void bench_persist_concurrent() {
+    for (int procs : { 1, 2, 4, 8 }) {
+        reset_store(10000);
+        run_bench("persist_concurrent/" + to_string(procs), procs * CONCURRENT_SETS, [=] {
+            persist_concurrent(procs);
+        });
+    }
+}
+
+#define BENCH_IO_FILE  PERSIST_PROP_DIR "/io.bin"
+
+// 各种只读I/O策略在不同文件大小下的耗时，用于确定IO_READ_MAX以及是否自动使用MAP_POPULATE。
+// 文件已在页缓存中，与读取存储文件时的情况相同；每次完整扫描一遍数据
+static void bench_io_mode() {
+    using mode = mmap_data::io_mode;
+    const pair<mode, const char *> modes[] = {
+        { mode::read, "read" }, { mode::map, "map" }, { mode::populate, "populate" },
+    };
+    for (size_t kb : { 4, 16, 64, 128, 256, 512, 1024, 2048, 4096, 16384 }) {
+        string data(kb * 1024, 'x');
+        int fd = open(BENCH_IO_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        write(fd, data.data(), data.size());
+        data = string();
+        for (auto [m, name] : modes) {
+            run_bench("io_" + string(name) + "/" + to_string(kb) + "K", 1, [=] {
+                mmap_data d(fd, kb * 1024, m);
+                if (d.sz() != kb * 1024 || memchr(d.buf(), 0, d.sz()))
+                    abort();
+            });
+        }
+        close(fd);
+    }
+    unlink(BENCH_IO_FILE);
+}
+
+#define LEGACY_PROPS  5000
+
+// 没有persistent_properties时逐个文件读取的传统格式目录
+static void bench_legacy() {
+    unlink(BENCH_STORE);
+    for (size_t i = 0; i < LEGACY_PROPS; ++i) {
+        auto path = PERSIST_PROP_DIR "/" + bench_name(i);
+        auto value = bench_value(i);
+        int fd = open(path.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        write(fd, value.data(), value.size());
+        close(fd);
+    }
+    run_bench("legacy_get_props/" + to_string(LEGACY_PROPS), LEGACY_PROPS, [] {
+        count_cb cb;
+        persist_get_props(&cb);
+        if (cb.n != LEGACY_PROPS)
+            abort();
+    });
+    for (size_t i = 0; i < LEGACY_PROPS; ++i)
+        unlink((PERSIST_PROP_DIR "/" + bench_name(i)).data());
+}
+
+static void bench_print_props() {
+    // 输出重定向到/dev/null，只测量枚举与排序
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    PropFlags flags;
+    prop_matcher none;
+    run_bench("print_props", 1, [&] {
+        print_props(flags, none, none);
+        fflush(stdout);
+    });
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    if (results.empty() || results.back().name != "print_props")
+        return;
+    auto &r = results.back();
+    printf("%-28s %12.1f ns/op %10.2f allocs/op %8ld KiB peak\n",
+           r.name.data(), r.ns_op, r.allocs_op, r.peak_rss_kb);
+}
+
+// 属性区域的测试镜像：复制到临时目录，在私有挂载命名空间中覆盖PROP_AREA_DIR，
+// 之后初始化的属性区域映射的都是镜像，测试中的修改不会影响真实的属性。
+// 必须在InitOnce之前调用
+static bool use_area_image() {
+    auto dir = open_dir(PROP_AREA_DIR);
+    if (!dir)
+        return false;
+    mkdir(BENCH_AREA, 0755);
+    for (dirent *entry; (entry = readdir(dir.get()));) {
+        if (entry->d_type != DT_REG)
+            continue;
+        auto src = string(PROP_AREA_DIR "/") + entry->d_name;
+        auto dst = string(BENCH_AREA "/") + entry->d_name;
+        mmap_data m(src.data(), mmap_data::io_mode::read);
+        int fd = open(dst.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+        if (fd < 0)
+            return false;
+        bool ok = write(fd, m.buf(), m.sz()) == m.sz();
+        close(fd);
+        if (!ok)
+            return false;
+    }
+    return unshare(CLONE_NEWNS) == 0 &&
+           mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) == 0 &&
+           mount(BENCH_AREA, PROP_AREA_DIR, nullptr, MS_BIND, nullptr) == 0;
+}
+
+static void remove_area_image() {
+    if (auto dir = open_dir(BENCH_AREA)) {
+        for (dirent *entry; (entry = readdir(dir.get()));) {
+            if (entry->d_type == DT_REG)
+                unlink((string(BENCH_AREA "/") + entry->d_name).data());
+        }
+    }
+    rmdir(BENCH_AREA);
+}
+
+// 在属性区域的测试镜像上测量直接修改整批属性的开销，需要root
+static void bench_apply() {
+    // 每个上下文取一个现有属性的前缀生成测试属性，使测试属性分布在所有属性区域中
+    vector<string> live;
+    __system_property_foreach([](const prop_info *pi, void *arg) {
+        static_cast<vector<string> *>(arg)->emplace_back(pi->name);
+    }, &live);
+    map<string_view, string> prefixes;
+    for (auto &name : live) {
+        auto context = __system_property_get_context(name.data());
+        auto dot = name.rfind('.');
+        if (context && dot != string::npos && !str_starts(name, "ro.") && !prefixes.count(context))
+            prefixes.emplace(context, name.substr(0, dot + 1));
+    }
+    if (prefixes.empty())
+        return;
+
+    vector<string> names;
+    for (auto &[_, prefix] : prefixes) {
+        for (size_t i = 0; i < 256; ++i)
+            names.push_back(prefix + "rpbench" + to_string(i));
+    }
+
+    PropFlags flags;
+    flags.setSkipSvc();
+    size_t rep = 0;
+    run_bench("apply/" + to_string(names.size()), names.size(), [&] {
+        vector<pair<string, string>> entries;
+        auto value = to_string(rep++);
+        for (auto &name : names)
+            entries.emplace_back(name, value);
+        auto plan = plan_props(entries, flags);
+        apply_plan(plan, flags);
+    });
+}
+
+// 启用审计时每次修改追加一条审计记录的开销
+static void bench_audit() {
+    constexpr size_t count = 1000;
+    if (!audit_enable(true))
+        return;
+    auto name = bench_name(0);
+    auto old_value = bench_value(0);
+    auto new_value = bench_value(1);
+    run_bench("audit_record", count, [&] {
+        for (size_t i = 0; i < count; ++i)
+            audit_record(audit_path::direct, name.data(), old_value.data(), new_value.data());
+    });
+    audit_enable(false);
+}
+
+// property_service的替身：按到达顺序记录请求，每攒够一批或暂时没有新请求时倒序应答。
+// 名称中含有".fail."的属性应答SVC_FAIL_RESULT；同名属性的上一个请求尚未应答时记为重叠，
+// 名称中含有".ro."的属性到达时仍有请求未应答记为未独占
+#define BENCH_SVC_SOCKET  PERSIST_PROP_DIR "/property_service"
+#define SVC_FAIL_RESULT   0x18
+#define SVC_REPLY_BATCH   8  // 与svc_set_props默认的在途窗口相同
+
+struct svc_standin {
+    // 处理total个请求后退出
+    bool start(size_t total) {
+        unlink(BENCH_SVC_SOCKET);
+        fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_LOCAL;
+        strscpy(addr.sun_path, BENCH_SVC_SOCKET, sizeof(addr.sun_path));
+        if (fd < 0 || bind(fd, (sockaddr *) &addr, sizeof(addr)) || listen(fd, 64))
+            return false;
+        worker = thread([=, this] { serve(total); });
+        return true;
+    }
+    void stop() {
+        if (worker.joinable())
+            worker.join();
+        close(fd);
+        unlink(BENCH_SVC_SOCKET);
+    }
+    vector<pair<string, string>> arrivals;
+    bool overlap = false;
+    bool shared = false;
+private:
+    void serve(size_t total) {
+        struct client_req {
+            int fd;
+            int32_t result;
+            size_t idx;  // arrivals中的下标
+        };
+        vector<client_req> held;
+        auto reply = [&] {
+            for (auto it = held.rbegin(); it != held.rend(); ++it) {
+                write(it->fd, &it->result, sizeof(it->result));
+                close(it->fd);
+            }
+            held.clear();
+        };
+        while (arrivals.size() < total) {
+            pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, held.empty() ? -1 : 10) <= 0) {
+                reply();
+                continue;
+            }
+            int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0)
+                break;
+            uint32_t cmd, len;
+            string name, value;
+            auto read_str = [&](string &str) {
+                if (recv(client, &len, sizeof(len), MSG_WAITALL) != sizeof(len))
+                    return false;
+                str.resize(len);
+                return recv(client, str.data(), len, MSG_WAITALL) == len;
+            };
+            if (recv(client, &cmd, sizeof(cmd), MSG_WAITALL) != sizeof(cmd) ||
+                !read_str(name) || !read_str(value)) {
+                close(client);
+                break;
+            }
+            for (auto &h : held)
+                overlap |= arrivals[h.idx].first == name;
+            shared |= str_contains(name, ".ro.") && !held.empty();
+            held.push_back({ client, str_contains(name, ".fail.") ? SVC_FAIL_RESULT : 0,
+                             arrivals.size() });
+            arrivals.emplace_back(std::move(name), std::move(value));
+            if (held.size() >= SVC_REPLY_BATCH)
+                reply();
+        }
+        reply();
+    }
+    int fd = -1;
+    thread worker;
+};
+
+// 流水线提交：同名属性的请求不重叠且按提交顺序到达，每个请求得到自己的应答，
+// recreate的请求发送时没有其他请求在途。属性数小于在途窗口，同名属性的请求总是相邻地等待提交
+static void check_svc_pipeline() {
+    constexpr size_t keys = 6;
+    constexpr size_t rounds = 16;
+    vector<svc_request> reqs;
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t k = 0; k < keys; ++k) {
+            auto name = "bench.svc." + string(k % 3 == 0 ? "fail." : k == 4 ? "ro." : "") +
+                        to_string(k);
+            reqs.push_back({ name, to_string(r), k == 4 });
+        }
+    }
+    svc_standin svc;
+    if (!svc.start(reqs.size())) {
+        check("svc_pipeline", false);
+        return;
+    }
+    int failed = svc_set_props(reqs, BENCH_SVC_SOCKET);
+    svc.stop();
+
+    bool ok = !svc.overlap && !svc.shared && svc.arrivals.size() == reqs.size() && failed == keys / 3 * rounds;
+    for (auto &r : reqs)
+        ok &= r.ret == (str_contains(r.name, ".fail.") ? SVC_FAIL_RESULT : 0);
+    map<string, string> seen;
+    for (auto &[name, value] : svc.arrivals) {
+        // 每个属性的值依次为0到rounds-1
+        auto &last = seen[name];
+        ok &= value == to_string(last.empty() ? 0 : stoi(last) + 1);
+        last = value;
+    }
+    check("svc_pipeline", ok);
+}
+
+// 基线文件格式：每行"名称 ns/op allocs/op"，#开头的行为注释
+static bool save_baseline(const char *file) {
+    auto fp = open_file(file, "we");
+    if (!fp) return false;
+    for (auto &r : results)
+        fprintf(fp.get(), "%s %.1f %.2f\n", r.name.data(), r.ns_op, r.allocs_op);
+    return true;
+}
+
+// 与基线比较，返回退化的测试项数
+static int compare_baseline(const char *file) {
+    auto fp = open_file(file, "re");
+    if (!fp) return -1;
+    map<string, pair<double, double>> base;
+    char line[256], name[128];
+    double ns, allocs;
+    while (fgets(line, sizeof(line), fp.get())) {
+        if (line[0] != '#' && sscanf(line, "%127s %lf %lf", name, &ns, &allocs) == 3)
+            base[name] = { ns, allocs };
+    }
+
+    int regressed = 0;
+    for (auto &r : results) {
+        auto it = base.find(r.name);
+        if (it == base.end())
+            continue;
+        auto [base_ns, base_allocs] = it->second;
+        bool slow = r.ns_op > base_ns * BENCH_REGRESS;
+        bool alloc = r.allocs_op > base_allocs * BENCH_REGRESS + 0.01;
+        if (slow || alloc) {
+            ++regressed;
+            printf("REGRESSION %s: %.1f -> %.1f ns/op, %.2f -> %.2f allocs/op\n", r.name.data(),
+                   base_ns, r.ns_op, base_allocs, r.allocs_op);
+        }
+    }
+    return regressed;
+}
+
+[[noreturn]] static void bench_usage(char *arg0) {
+    fprintf(stderr,
+R"EOF(resetprop_bench - resetprop hot path benchmarks
+
+Usage: %s [--filter NAME] [--apply] [--baseline FILE] [--save FILE]
+
+Fixtures are generated under )EOF" PERSIST_PROP_DIR R"EOF(. Correctness checks
+run first; any failed check makes the exit status 1.
+
+Options:
+   --filter NAME     only run benchmarks whose name contains NAME
+   --apply           also measure applying a batch of properties directly,
+                     on a copy of the property areas mounted in a private
+                     mount namespace; requires root
+   --baseline FILE   compare with FILE, exit 1 if any benchmark regressed
+                     more than 20%% in ns/op or allocs/op
+   --save FILE       write the results to FILE as the new baseline;
+                     baselines are per device, save one on the target
+
+)EOF", arg0);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *baseline = nullptr;
+    const char *save = nullptr;
+    bool apply = false;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i] == "--baseline"sv && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (argv[i] == "--apply"sv) {
+            apply = true;
+        } else if (argv[i] == "--filter"sv && i + 1 < argc) {
+            bench_filter = argv[++i];
+        } else if (argv[i] == "--save"sv && i + 1 < argc) {
+            save = argv[++i];
+        } else {
+            bench_usage(argv[0]);
+        }
+    }
+
+    // 持久化存储在第一次访问前必须存在，才会使用protobuf格式
+    mkdir(PERSIST_PROP_DIR, 0700);
+    run_in_child(bench_legacy);
+    reset_store(0);
+    if (apply && !use_area_image()) {
+        fprintf(stderr, "cannot set up the property area image, skip apply\n");
+        apply = false;
+    }
+    InitOnce();
+
+    check_svc_pipeline();
+    check_persist_concurrent();
+    check_persist_stale_journal();
+    bench_parse();
+    bench_check_name();
+    bench_stream();
+    bench_persist();
+    bench_persist_concurrent();
+    bench_io_mode();
+    bench_print_props();
+    bench_audit();
+    if (apply)
+        bench_apply();
+
+    unlink(BENCH_STORE);
+    unlink(BENCH_STORE ".journal");
+    unlink(BENCH_STORE ".lock");
+    unlink(BENCH_STORE ".journal.lock");
+    remove_area_image();
+    rmdir(PERSIST_PROP_DIR);
+
+    if (failed_checks)
+        return 1;
+    if (save && !save_baseline(save))
+        return 1;
+    if (baseline) {
+        int regressed = compare_baseline(baseline);
+        if (regressed < 0)
+            return 1;
+        printf("%d benchmarks regressed against %s\n", regressed, baseline);
+        return regressed ? 1 : 0;
+    }
+    return 0;
+}
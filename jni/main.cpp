@@ -0,0 +1,307 @@
+// resetprop命令行入口
+#include <algorithm>
+#include <vector>
+
+#include "logging.h"
+#include "resetprop_impl.hpp"
+
+using namespace std;
+
+// 显示使用帮助信息
+[[noreturn]] static void usage(char* arg0) {
+    fprintf(stderr,
+R"EOF(resetprop - System Property Manipulation Tool
+
+Usage: %s [flags] [arguments...]
+
+Read mode arguments:
+   (no arguments)    print all properties
+   --grep-name  PATTERN
+                     only print properties whose name contains PATTERN
+   --grep-value PATTERN
+                     only print properties whose value contains PATTERN
+                     (both can be repeated; any pattern of a kind matches)
+   NAME              get property
+
+Write mode arguments:
+   NAME VALUE        set property NAME as VALUE
+   -f,--file   FILE...
+                     load and set properties from FILEs, directories are
+                     expanded in lexical order and later files win;
+                     the list ends at the next argument starting with
+                     -, so flags may follow it; a single - streams from
+                     stdin, setting properties while the input is still
+                     being read; - can be given only once
+   -f FILE... --checkpoint NAME
+                     record the previous value of every property the
+                     load changes, live and persistent, as checkpoint NAME
+   --rollback NAME   restore the properties recorded in checkpoint NAME
+   --plan -f FILE... print what loading FILEs would change and what it
+                     would cost, without writing anything
+   --compile FILE -o BUNDLE
+                     validate, merge and sort FILEs (--compile can be
+                     repeated) into the binary property bundle BUNDLE
+   --apply-bundle BUNDLE
+                     set properties from BUNDLE, skipped if the same
+                     bundle was already applied with the same flags
+                     since boot
+   -d,--delete NAME  delete property
+   --compact         fold the persist journal back into storage
+   --audit           print the audit log of property changes
+   --audit-enable    start recording every property change made by
+                     resetprop in a shared ring of the last 512 changes
+   --audit-disable   stop recording and discard the audit log
+   --watch-persist   print persistent props as they change in storage,
+                     [NAME]: [VALUE] when set and [NAME]: <deleted>
+
+General flags:
+   -h,--help         show this message
+   -v                print verbose output to stderr
+
+Read mode flags:
+   -p      also read persistent props from storage
+   -P      only read persistent props from storage
+   -Z      get property context instead of value
+   -E      treat --grep-* PATTERNs as POSIX extended regexes
+
+Write mode flags:
+   -n      set properties bypassing property_service
+   -N      set ro properties using property_service
+   -p      always write persistent prop changes to storage
+   -j      append persistent prop changes to a journal, compacted
+           into storage when it grows large or with --compact
+
+)EOF", arg0);
+    exit(1);
+}
+
+// 消费下一个参数的宏定义
+#define consume_next(val)    \
+if (argc != 2) usage(argv0); \
+val = argv[1];               \
+stop_parse = true;           \
+
+// 消费下一个参数并继续解析的宏定义
+#define consume_arg(fn)      \
+if (argc < 2) usage(argv0);  \
+fn(argv[1]);                 \
+--argc;                      \
+++argv;                      \
+
+// 消费到下一个选项为止的所有参数的宏定义，单独的"-"不是选项
+#define consume_list(vec)    \
+if (argc < 2 || (argv[1][0] == '-' && argv[1] != "-"sv)) usage(argv0); \
+while (argc >= 2 && (argv[1][0] != '-' || argv[1] == "-"sv)) { \
+    vec.push_back(argv[1]);  \
+    --argc;                  \
+    ++argv;                  \
+}                            \
+
+// 主函数
+int main(int argc, char *argv[]) {
+    PropFlags flags;
+    char *argv0 = argv[0];
+    // set_log_level_state(LogLevel::Debug, false);
+
+    vector<const char *> prop_files;
+    const char *prop_to_rm = nullptr;
+
+    --argc;
+    ++argv;
+
+    bool ro_use_svc = false;
+    bool compact = false;
+    bool watch_persist = false;
+    const char *audit_cmd = nullptr;
+    const char *checkpoint = nullptr;
+    const char *rollback_name = nullptr;
+    bool plan_only = false;
+    vector<const char *> compile_files;
+    const char *bundle_out = nullptr;
+    const char *bundle_in = nullptr;
+    bool use_regex = false;
+    prop_matcher names, values;
+
+    // 解析标志和长选项
+    while (argc && argv[0][0] == '-') {
+        bool stop_parse = false;
+        bool file_list = false;  // 同一参数中的其他标志解析完后再消费文件列表
+        for (int idx = 1; true; ++idx) {
+            switch (argv[0][idx]) {
+            case '-':
+                if (argv[0] == "--file"sv) {
+                    consume_list(prop_files);
+                } else if (argv[0] == "--delete"sv) {
+                    consume_next(prop_to_rm);
+                } else if (argv[0] == "--compact"sv) {
+                    compact = true;
+                } else if (argv[0] == "--checkpoint"sv) {
+                    consume_arg([&](const char *name) { checkpoint = name; });
+                } else if (argv[0] == "--rollback"sv) {
+                    consume_next(rollback_name);
+                } else if (argv[0] == "--watch-persist"sv) {
+                    watch_persist = true;
+                } else if (argv[0] == "--audit"sv || argv[0] == "--audit-enable"sv ||
+                           argv[0] == "--audit-disable"sv) {
+                    audit_cmd = argv[0] + 2;
+                } else if (argv[0] == "--plan"sv) {
+                    plan_only = true;
+                } else if (argv[0] == "--compile"sv) {
+                    consume_arg(compile_files.push_back);
+                } else if (argv[0] == "--apply-bundle"sv) {
+                    consume_next(bundle_in);
+                } else if (argv[0] == "--grep-name"sv) {
+                    consume_arg(names.add);
+                } else if (argv[0] == "--grep-value"sv) {
+                    consume_arg(values.add);
+                } else {
+                    usage(argv0);
+                }
+                break;
+            case 'd':
+                consume_next(prop_to_rm);
+                continue;
+            case 'f':
+                file_list = true;
+                continue;
+            case 'o': {
+                if (argv[0][idx + 1])  // -o之后的标志会被忽略
+                    usage(argv0);
+                consume_arg([&](const char *out) { bundle_out = out; });
+                break;
+            }
+            case 'n':
+                flags.setSkipSvc();  // 绕过property_service
+                continue;
+            case 'p':
+                flags.setPersist();  // 处理持久化属性
+                continue;
+            case 'j':
+                persist_use_journal(true);  // 持久化属性写入日志
+                continue;
+            case 'P':
+                flags.setPersistOnly();  // 仅处理持久化属性
+                continue;
+            case 'v':
+                // set_log_level_state(LogLevel::Debug, true);
+                verbose = true;
+                continue;
+            case 'Z':
+                flags.setContext();  // 获取SELinux上下文
+                continue;
+            case 'E':
+                use_regex = true;  // 按正则表达式过滤
+                continue;
+            case 'N':
+                ro_use_svc = true;  // 只读属性使用property_service
+                continue;
+            case '\0':
+                break;
+            default:
+                usage(argv0);
+            }
+            break;
+        }
+        if (file_list) {
+            if (stop_parse)  // -f与-d不能共用后面的参数
+                usage(argv0);
+            consume_list(prop_files);
+        }
+        --argc;
+        ++argv;
+        if (stop_parse)
+            break;
+    }
+
+    // -f需要至少一个文件且之后不能再有其他参数，标准输入只能读取一次，--plan只用于属性文件
+    bool load = !prop_files.empty();
+    auto stdin_count = count_if(prop_files.begin(), prop_files.end(),
+                                [](const char *f) { return f == "-"sv; });
+    if ((load && argc) || stdin_count > 1 || (plan_only && !load)) {
+        usage(argv0);
+    }
+
+    // 压缩持久化属性日志
+    if (compact) {
+        return persist_compact() ? 0 : 1;
+    }
+
+    // 审计记录
+    if (audit_cmd) {
+        if (audit_cmd == "audit"sv) {
+            if (audit_dump(stdout))
+                return 0;
+            fprintf(stderr, "audit is not enabled, use --audit-enable\n");
+            return 1;
+        }
+        return audit_enable(audit_cmd == "audit-enable"sv) ? 0 : 1;
+    }
+
+    // 持续输出持久化属性的变化
+    if (watch_persist) {
+        return persist_watch([](const char *name, const char *value) {
+            if (value)
+                printf("[%s]: [%s]\n", name, value);
+            else
+                printf("[%s]: <deleted>\n", name);
+            return fflush(stdout) == 0;
+        }) ? 0 : 1;
+    }
+
+    InitOnce();
+
+    // 如果指定了要删除的属性
+    if (prop_to_rm) {
+        return delete_prop(prop_to_rm, flags);
+    }
+
+    // 编译或应用属性包
+    if (!compile_files.empty()) {
+        if (bundle_out == nullptr)
+            usage(argv0);
+        return compile_bundle(compile_files, bundle_out);
+    }
+    if (bundle_in) {
+        return apply_bundle(bundle_in, flags) ? 1 : 0;
+    }
+
+    // 回滚到检查点
+    if (rollback_name) {
+        return rollback(rollback_name) ? 1 : 0;
+    }
+
+    // 如果指定了属性文件
+    if (load) {
+        // 单独的"-"从标准输入流式读取，需要检查点时整体读取后再设置
+        if (prop_files.size() == 1 && prop_files[0] == "-"sv && !plan_only && !checkpoint)
+            return load_stream(flags) ? 1 : 0;
+        return load_files(prop_files, flags, plan_only, checkpoint) ? 1 : 0;
+    }
+
+    // 根据参数数量决定操作类型
+    switch (argc) {
+    case 0:
+        // 无参数：打印所有属性
+        if (!names.compile(use_regex) || !values.compile(use_regex))
+            return 1;
+        return print_props(flags, names, values);
+    case 1: {
+        // 一个参数：获取指定属性值
+        auto val = get_prop(argv[0], flags);
+        if (val.empty())
+            return 1;
+        printf("%s\n", val.data());
+        return 0;
+    }
+    case 2: {
+        // 两个参数：设置属性
+        auto name = argv[0];
+        if (str_starts(name, "ro.") && !ro_use_svc) {
+            flags.setSkipSvc();  // 只读属性默认绕过property_service
+        }
+        return set_prop(name, argv[1], flags);
+    }
+    default:
+        usage(argv0);
+    }
+}
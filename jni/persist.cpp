@@ -1,13 +1,16 @@
 // 持久化属性处理实现
 #include <pb.h>
-#include <pb_decode.h>
 #include <pb_encode.h>
 
 #include "resetprop.hpp"
 
 #include <cstring>
+#include <cerrno>
 #include <string>
+#include <vector>
 #include <unistd.h>
+#include <sys/inotify.h>
+#include <poll.h>
 #include "logging.h"
 #include "base.hpp"
 #include <stdlib.h>
@@ -34,15 +37,14 @@ struct PersistentProperties {
 
 struct PersistentProperties_PersistentPropertyRecord {
     pb_callback_t name;
-    bool has_value;
-    char value[92];
+    pb_callback_t value;
 };
 
 /* 消息结构体的初始化值 */
 #define PersistentProperties_init_default        {{{NULL}, NULL}}
-#define PersistentProperties_PersistentPropertyRecord_init_default {{{NULL}, NULL}, false, ""}
+#define PersistentProperties_PersistentPropertyRecord_init_default {{{NULL}, NULL}, {{NULL}, NULL}}
 #define PersistentProperties_init_zero           {{{NULL}, NULL}}
-#define PersistentProperties_PersistentPropertyRecord_init_zero {{{NULL}, NULL}, false, ""}
+#define PersistentProperties_PersistentPropertyRecord_init_zero {{{NULL}, NULL}, {{NULL}, NULL}}
 
 /* 字段标签（用于手动编码/解码） */
 #define PersistentProperties_properties_tag      1
@@ -58,7 +60,7 @@ X(a, CALLBACK, REPEATED, MESSAGE,  properties,        1)
 
 #define PersistentProperties_PersistentPropertyRecord_FIELDLIST(X, a) \
 X(a, CALLBACK, OPTIONAL, STRING,   name,              1) \
-X(a, STATIC,   OPTIONAL, STRING,   value,             2)
+X(a, CALLBACK, OPTIONAL, STRING,   value,             2)
 #define PersistentProperties_PersistentPropertyRecord_CALLBACK pb_default_field_callback
 #define PersistentProperties_PersistentPropertyRecord_DEFAULT NULL
 
@@ -81,100 +83,532 @@ PB_BIND(PersistentProperties_PersistentPropertyRecord, PersistentProperties_Pers
  * 自动生成代码结束
  * ***************************/
 
+#ifndef PERSIST_PROP_DIR
 #define PERSIST_PROP_DIR  "/data/property"
-#define PERSIST_PROP      PERSIST_PROP_DIR "/persistent_properties"
+#endif
+#define PERSIST_PROP_NAME "persistent_properties"
+#define PERSIST_PROP      PERSIST_PROP_DIR "/" PERSIST_PROP_NAME
 
-// 属性名称解码回调函数
-static bool name_decode(pb_istream_t *stream, const pb_field_t *, void **arg) {
-    string &name = *static_cast<string *>(*arg);
-    name.resize(stream->bytes_left);
-    return pb_read(stream, (pb_byte_t *)(name.data()), stream->bytes_left);
-}
+// 所有持久化存储的读取都根据文件大小选择I/O策略
+static constexpr auto persist_io = mmap_data::io_mode::automatic;
 
-// 属性名称编码回调函数
-static bool name_encode(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+// 字符串字段编码回调函数
+static bool string_encode(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
     return pb_encode_tag_for_field(stream, field) &&
            pb_encode_string(stream, (const pb_byte_t *) *arg, strlen((const char *) *arg));
 }
 
-// 属性解码回调函数
-static bool prop_decode(pb_istream_t *stream, const pb_field_t *, void **arg) {
-    PersistentProperties_PersistentPropertyRecord prop{};
-    string name;
-    prop.name.funcs.decode = name_decode;
-    prop.name.arg = &name;
-    if (!pb_decode(stream, &PersistentProperties_PersistentPropertyRecord_msg, &prop))
+// 读取varint，失败时返回false
+static bool read_varint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+// 跳过一个字段，length-delimited字段通过field返回其内容
+static bool skip_field(const uint8_t *&p, const uint8_t *end, uint64_t tag, string_view *field) {
+    uint64_t v;
+    switch (tag & 7) {
+    case 0:  // varint
+        return read_varint(p, end, v);
+    case 1:  // 64位定长
+        if (end - p < 8) return false;
+        p += 8;
+        return true;
+    case 2:  // length-delimited
+        if (!read_varint(p, end, v) || v > (uint64_t) (end - p))
+            return false;
+        if (field)
+            *field = string_view((const char *) p, v);
+        p += v;
+        return true;
+    case 5:  // 32位定长
+        if (end - p < 4) return false;
+        p += 4;
+        return true;
+    default:
         return false;
-    auto cb = static_cast<prop_cb*>(*arg);
-    cb->exec(name.data(), prop.value);
+    }
+}
+
+// 解析一条属性记录的名称和值，均指向记录内部
+static bool pb_record(string_view record, string_view &name, string_view &value) {
+    auto q = (const uint8_t *) record.data();
+    auto rend = q + record.size();
+    while (q < rend) {
+        uint64_t tag;
+        string_view field;
+        if (!read_varint(q, rend, tag) || !skip_field(q, rend, tag, &field))
+            return false;
+        if (tag == ((PersistentProperties_PersistentPropertyRecord_name_tag << 3) | 2))
+            name = field;
+        else if (tag == ((PersistentProperties_PersistentPropertyRecord_value_tag << 3) | 2))
+            value = field;
+    }
     return true;
 }
 
-// 属性编码回调函数
-static bool prop_encode(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
-    PersistentProperties_PersistentPropertyRecord prop{};
-    prop.name.funcs.encode = name_encode;
-    prop.has_value = true;
-    prop_list &list = *static_cast<prop_list *>(*arg);
-    for (auto &p : list) {
-        if (!pb_encode_tag_for_field(stream, field))
+// 直接在缓冲区上遍历属性记录，不经过nanopb。
+// 名称和值指向缓冲区内部，不分配内存也不截断长度；回调返回false时停止遍历
+static bool pb_foreach(byte_view data, const function<bool(string_view, string_view)> &fn) {
+    const uint8_t *p = data.buf();
+    const uint8_t *end = p + data.sz();
+    while (p < end) {
+        uint64_t tag;
+        string_view record;
+        if (!read_varint(p, end, tag) || !skip_field(p, end, tag, &record))
             return false;
-        prop.name.arg = (void *) p.first.data();
-        strscpy(prop.value, p.second.data(), sizeof(prop.value));
-        if (!pb_encode_submessage(stream, &PersistentProperties_PersistentPropertyRecord_msg, &prop))
+        if (tag != ((PersistentProperties_properties_tag << 3) | 2))
+            continue;
+
+        string_view name, value;
+        if (!pb_record(record, name, value))
             return false;
+        if (!fn(name, value))
+            return true;
     }
     return true;
 }
 
-// 写入回调函数，用于protobuf输出流
-static bool write_callback(pb_ostream_t *stream, const uint8_t *buf, size_t count) {
-    int fd = (intptr_t)stream->state;
-    return write(fd, buf, count) == count;
+// 输出流写入回调，追加到字符串缓冲区
+static bool string_write(pb_ostream_t *stream, const uint8_t *buf, size_t count) {
+    static_cast<string *>(stream->state)->append((const char *) buf, count);
+    return true;
 }
 
-// 创建protobuf输出流
-static pb_ostream_t create_ostream(int fd) {
-    pb_ostream_t o = {
-        .callback = write_callback,
-        .state = (void*)(intptr_t)fd,
+// 将一条属性记录连同顶层字段标签编码到缓冲区末尾
+static bool pb_encode_record(string &out, const string &name, const string &value) {
+    pb_ostream_t ostream = {
+        .callback = string_write,
+        .state = &out,
         .max_size = SIZE_MAX,
         .bytes_written = 0,
     };
-    return o;
+    PersistentProperties_PersistentPropertyRecord prop{};
+    prop.name.funcs.encode = string_encode;
+    prop.name.arg = (void *) name.data();
+    prop.value.funcs.encode = string_encode;
+    prop.value.arg = (void *) value.data();
+    return pb_encode_tag(&ostream, PB_WT_STRING, PersistentProperties_properties_tag) &&
+           pb_encode_submessage(&ostream, &PersistentProperties_PersistentPropertyRecord_msg, &prop);
+}
+
+// 解码protobuf格式的属性数据，名称和值复制到复用的缓冲区中以添加null终止符
+static void pb_decode_props(byte_view data, prop_cb *prop_cb) {
+    string name, value;
+    pb_foreach(data, [&](string_view n, string_view v) -> bool {
+        name.assign(n);
+        value.assign(v);
+        prop_cb->exec(name.data(), value.data());
+        return true;
+    });
 }
 
 // 使用protobuf格式获取属性
 static void pb_get_prop(prop_cb *prop_cb) {
     LOGD("resetprop: decode with protobuf [" PERSIST_PROP "]\n");
-    PersistentProperties props{};
-    props.properties.funcs.decode = prop_decode;
-    props.properties.arg = prop_cb;
-    mmap_data m(PERSIST_PROP);
-    pb_istream_t stream = pb_istream_from_buffer(m.buf(), m.sz());
-    pb_decode(&stream, &PersistentProperties_msg, &props);
+    mmap_data m(PERSIST_PROP, persist_io);
+    pb_decode_props(m, prop_cb);
 }
 
-// 使用protobuf格式写入属性
-static bool pb_write_props(prop_list &list) {
-    char tmp[4096];
-    strscpy(tmp, PERSIST_PROP ".XXXXXX", sizeof(tmp));
+// 待写入存储文件的修改，值为空表示删除
+struct persist_change {
+    optional<string> value;
+    bool written = false;
+};
+using persist_changes = map<string, persist_change, less<>>;
+
+// 流式重写存储文件到临时文件，由调用者rename替换存储文件。
+// 未修改的记录按原字节整段复制，只有修改和新增的记录经过nanopb编码，
+// 内存占用只与修改的数量有关，与存储文件大小无关
+static bool pb_rewrite_props(byte_view store, persist_changes &changes, char *tmp, size_t size) {
+    strscpy(tmp, PERSIST_PROP ".XXXXXX", size);
     int fd = mkostemp(tmp, O_CLOEXEC);
     if (fd < 0)
         return false;
+    LOGD("resetprop: rewrite with protobuf [%s]\n", tmp);
 
-    pb_ostream_t ostream = create_ostream(fd);
-    PersistentProperties props{};
-    props.properties.funcs.encode = prop_encode;
-    props.properties.arg = &list;
-    LOGD("resetprop: encode with protobuf [%s]\n", tmp);
-    bool ret = pb_encode(&ostream, &PersistentProperties_msg, &props);
+    bool ok = true;
+    auto write_all = [&](const void *buf, size_t len) {
+        if (ok && len && write(fd, buf, len) != len)
+            ok = false;
+    };
+
+    const uint8_t *p = store.buf();
+    const uint8_t *end = p + store.sz();
+    const uint8_t *run = p;  // 尚未写出的连续未修改数据的起点
+    string buf;
+    while (ok && p < end) {
+        const uint8_t *field = p;
+        uint64_t tag;
+        string_view record, name, value;
+        if (!read_varint(p, end, tag) || !skip_field(p, end, tag, &record) ||
+            (tag == ((PersistentProperties_properties_tag << 3) | 2) &&
+             !pb_record(record, name, value))) {
+            // 与解码相同，丢弃无法解析的尾部数据
+            LOGW("resetprop: drop corrupted data at offset %zu\n", (size_t) (field - store.buf()));
+            end = field;
+            break;
+        }
+        if (tag != ((PersistentProperties_properties_tag << 3) | 2))
+            continue;
+        auto it = changes.find(name);
+        if (it == changes.end())
+            continue;
+        auto &c = it->second;
+        if (c.value && !c.written && *c.value == value) {
+            // 值未改变，原记录保留在连续区间中
+            c.written = true;
+            continue;
+        }
+        write_all(run, field - run);
+        run = p;
+        if (c.value && !c.written) {
+            buf.clear();
+            ok = ok && pb_encode_record(buf, it->first, *c.value);
+            write_all(buf.data(), buf.size());
+            c.written = true;
+        }
+    }
+    write_all(run, end - run);
+
+    // 新增的属性追加到末尾
+    buf.clear();
+    for (auto &[name, c] : changes) {
+        if (c.value && !c.written)
+            ok = ok && pb_encode_record(buf, name, *c.value);
+    }
+    write_all(buf.data(), buf.size());
     close(fd);
-    if (!ret)
+    if (!ok) {
+        unlink(tmp);
         return false;
+    }
 
     clone_attr(PERSIST_PROP, tmp);  // 复制原文件的属性
-    return rename(tmp, PERSIST_PROP) == 0;  // 原子性替换
+    return true;
+}
+
+/* ***************************
+ * 追加式日志与组提交
+ * ***************************/
+
+// 所有protobuf格式的写入都先追加到日志，再由提交步骤合并回init读取的persistent_properties。
+// 日志头记录了对应存储文件的inode和修改时间，每条记录同时保存属性在追加时的值。
+// init每次设置persist属性都会重写存储文件，此时日志头不再匹配：
+// 属性的当前值仍等于记录中修改前的值时，说明init没有修改过它，记录照常重放；
+// 否则init的修改更晚，丢弃这条记录。提交在两次rename之间崩溃时，
+// 已合并的记录因当前值不同被跳过，之后追加的记录仍与新存储文件一致，同样不会丢失。
+//
+// 两把建议锁协调多个进程：
+//   JOURNAL_LOCK 保护日志追加，以及存储文件与日志的替换，只在短时间内持有
+//   PERSIST_LOCK 保证同一时间只有一个提交者，编码期间其他进程仍可追加日志
+// 等待PERSIST_LOCK的写入者的记录会被当前提交者之后的下一次提交一并合并，
+// 轮到它们时日志已为空，无需再次重写存储文件。
+
+#define PERSIST_JOURNAL       PERSIST_PROP ".journal"
+#define PERSIST_LOCK          PERSIST_PROP ".lock"
+#define JOURNAL_LOCK          PERSIST_JOURNAL ".lock"
+#define JOURNAL_MAGIC         0x324a5052  // "RPJ2"
+#define JOURNAL_COMPACT_SIZE  (64 * 1024)  // 日志模式下日志超过此大小时自动提交
+
+enum : uint8_t {
+    JOURNAL_SET = 1,
+    JOURNAL_DELETE = 2,
+};
+
+struct journal_header {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t base_ino;     // 对应的存储文件inode
+    int64_t base_mtime;    // 对应的存储文件修改时间（纳秒）
+};
+
+// 记录格式：journal_record | 名称 | 值 | 修改前的值 | CRC32
+struct journal_record {
+    uint8_t op;
+    uint8_t has_old;  // 修改前属性是否存在
+    uint8_t reserved[2];
+    uint32_t name_len;
+    uint32_t value_len;
+    uint32_t old_len;
+};
+
+// 解析后的一条记录，均指向日志内部
+struct journal_entry {
+    uint8_t op;
+    string_view name;
+    string_view value;
+    optional<string_view> old;
+};
+
+// 属性名到当前值的映射，值为空表示属性不存在；均指向日志、存储文件或批量修改内部
+using journal_values = map<string_view, optional<string_view>>;
+
+static bool use_journal = false;
+
+// 启用日志模式写入
+void persist_use_journal(bool enable) {
+    use_journal = enable;
+}
+
+// 根据存储文件状态生成日志头
+static void journal_base(const struct stat &st, journal_header &h) {
+    h.magic = JOURNAL_MAGIC;
+    h.reserved = 0;
+    h.base_ino = st.st_ino;
+    h.base_mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// 获取当前存储文件对应的日志头
+static bool journal_base(journal_header &h) {
+    struct stat st{};
+    if (stat(PERSIST_PROP, &st))
+        return false;
+    journal_base(st, h);
+    return true;
+}
+
+// 映射存储文件，并获取与这份数据对应的日志头
+static mmap_data pb_map(journal_header &h) {
+    int fd = open(PERSIST_PROP, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return {};
+    run_finally g([=] { close(fd); });
+    struct stat st{};
+    if (fstat(fd, &st))
+        return {};
+    journal_base(st, h);
+    return mmap_data(fd, st.st_size, persist_io);
+}
+
+// 读取日志头，日志过短或magic不匹配时返回false
+static bool journal_head(byte_view data, journal_header &h) {
+    if (data.sz() < sizeof(h))
+        return false;
+    memcpy(&h, data.buf(), sizeof(h));
+    return h.magic == JOURNAL_MAGIC;
+}
+
+// 遍历日志中的全部记录，返回有效数据的末尾偏移。
+// 没有有效的日志头时返回0；遇到校验失败的记录（写入中断）时停止
+static size_t journal_replay(byte_view data,
+        const function<void(const journal_entry &)> &fn = nullptr) {
+    journal_header h{};
+    if (!journal_head(data, h))
+        return 0;
+
+    size_t off = sizeof(h);
+    while (data.sz() - off >= sizeof(journal_record)) {
+        journal_record r{};
+        memcpy(&r, data.buf() + off, sizeof(r));
+        uint64_t payload = (uint64_t) r.name_len + r.value_len + r.old_len;
+        if (data.sz() - off - sizeof(r) < payload + sizeof(uint32_t))
+            break;
+        size_t len = sizeof(r) + payload;
+        uint32_t crc;
+        memcpy(&crc, data.buf() + off + len, sizeof(crc));
+        if (crc != crc32_ieee(data.buf() + off, len))
+            break;
+        auto p = reinterpret_cast<const char *>(data.buf() + off + sizeof(r));
+        journal_entry e{ r.op, string_view(p, r.name_len),
+                         string_view(p + r.name_len, r.value_len), nullopt };
+        if (r.has_old)
+            e.old = string_view(p + r.name_len + r.value_len, r.old_len);
+        if (fn)
+            fn(e);
+        off += len + sizeof(crc);
+    }
+    return off;
+}
+
+// 在存储文件中查找values中各属性的值，values中的值须为空。
+// 与解码时相同，同名属性以第一条为准
+static void pb_lookup(byte_view store, journal_values &values) {
+    size_t left = values.size();
+    pb_foreach(store, [&](string_view name, string_view value) -> bool {
+        auto it = values.find(name);
+        if (it != values.end() && !it->second) {
+            it->second = value;
+            --left;
+        }
+        return left > 0;
+    });
+}
+
+// 遍历日志中应当生效的记录，返回有效数据的末尾偏移。
+// 日志头与存储文件base匹配时全部生效；不匹配时只重放修改前的值与属性当前值一致的记录，
+// 当前值为存储文件中的值叠加此前已生效的记录
+static size_t journal_apply(byte_view data, byte_view store, const journal_header &base,
+                            const function<void(const journal_entry &)> &fn) {
+    journal_header h{};
+    if (!journal_head(data, h))
+        return 0;
+    if (h.base_ino == base.base_ino && h.base_mtime == base.base_mtime)
+        return journal_replay(data, fn);
+
+    journal_values cur;
+    journal_replay(data, [&](const journal_entry &e) { cur.try_emplace(e.name); });
+    pb_lookup(store, cur);
+    return journal_replay(data, [&](const journal_entry &e) {
+        auto &v = cur.find(e.name)->second;
+        bool same = e.old ? v && *v == *e.old : !v;
+        if (!same) {
+            // init之后修改过这个属性；结果与记录相同时（已合并的记录）不必报告
+            bool applied = e.op == JOURNAL_SET ? v && *v == e.value : !v;
+            if (!applied) {
+                LOGW("resetprop: drop journal record [%.*s], changed in storage since\n",
+                     (int) e.name.size(), e.name.data());
+            }
+            return;
+        }
+        if (e.op == JOURNAL_SET)
+            v = e.value;
+        else
+            v.reset();
+        fn(e);
+    });
+}
+
+// 将日志中的修改合并到属性列表，返回有效数据的末尾偏移
+static size_t journal_merge(byte_view data, byte_view store, const journal_header &base,
+                            prop_list &list) {
+    return journal_apply(data, store, base, [&](const journal_entry &e) {
+        if (e.op == JOURNAL_SET)
+            list[string(e.name)] = e.value;
+        else
+            list.erase(string(e.name));
+    });
+}
+
+// 将日志中的修改按属性名合并，同一属性只保留最后一次修改，返回有效数据的末尾偏移
+static size_t journal_changes(byte_view data, byte_view store, const journal_header &base,
+                              persist_changes &changes) {
+    return journal_apply(data, store, base, [&](const journal_entry &e) {
+        auto &c = changes[string(e.name)];
+        if (e.op == JOURNAL_SET)
+            c.value = e.value;
+        else
+            c.value.reset();
+    });
+}
+
+// 将新的日志头和记录写入临时文件，由调用者rename替换日志；没有记录时不创建文件，tmp为空
+static bool journal_prepare(const journal_header &h, byte_view records, char *tmp, size_t size) {
+    tmp[0] = '\0';
+    if (records.sz() == 0)
+        return true;
+    strscpy(tmp, PERSIST_JOURNAL ".XXXXXX", size);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ret = write(fd, &h, sizeof(h)) == sizeof(h) &&
+               write(fd, records.buf(), records.sz()) == records.sz();
+    close(fd);
+    if (!ret) {
+        unlink(tmp);
+        tmp[0] = '\0';
+    }
+    return ret;
+}
+
+// 向日志追加一批记录，并返回追加后的日志大小
+static bool journal_append(const persist_batch &batch, size_t &size) {
+    file_lock lock(JOURNAL_LOCK);
+    if (!lock.locked())
+        return false;
+    int fd = open(PERSIST_JOURNAL, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+    run_finally g([=] { close(fd); });
+
+    struct stat st{};
+    journal_header h{};
+    if (fstat(fd, &st) || !journal_base(h))
+        return false;
+    auto m = pb_map(h);
+    mmap_data j(fd, st.st_size, persist_io);
+
+    // 每条记录保存属性在追加时的值：存储文件中的值叠加日志中已生效的记录，
+    // 同一批中的后续记录以前面的修改为准
+    journal_values cur;
+    for (auto &[name, value] : batch)
+        cur.try_emplace(name);
+    pb_lookup(m, cur);
+    journal_apply(j, m, h, [&](const journal_entry &e) {
+        auto it = cur.find(e.name);
+        if (it == cur.end())
+            return;
+        if (e.op == JOURNAL_SET)
+            it->second = e.value;
+        else
+            it->second.reset();
+    });
+
+    // 日志头与存储文件不匹配时保留原有记录继续追加，下次提交时一并重放
+    size_t end = journal_replay(j);
+    if (end == 0) {
+        // 新建或无法解析的日志，重写日志头
+        if (ftruncate(fd, 0) || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+            return false;
+        end = sizeof(h);
+    } else if (end != st.st_size && ftruncate(fd, end)) {
+        // 丢弃写入中断的尾部记录
+        return false;
+    }
+
+    string buf;
+    for (auto &[name, value] : batch) {
+        auto &old = cur.find(name)->second;
+        journal_record r{};
+        r.op = value ? JOURNAL_SET : JOURNAL_DELETE;
+        r.has_old = old.has_value();
+        r.name_len = name.length();
+        r.value_len = value ? value->length() : 0;
+        r.old_len = old ? old->length() : 0;
+        size_t start = buf.size();
+        buf.append((const char *) &r, sizeof(r));
+        buf.append(name);
+        if (value)
+            buf.append(*value);
+        if (old)
+            buf.append(*old);
+        old = value ? optional<string_view>(*value) : nullopt;
+        uint32_t crc = crc32_ieee(buf.data() + start, buf.size() - start);
+        buf.append((const char *) &crc, sizeof(crc));
+        LOGD("resetprop: append to journal [%s]\n", name.data());
+    }
+
+    // 整批记录一次写入
+    if (pwrite(fd, buf.data(), buf.size(), end) != buf.size())
+        return false;
+    size = end + buf.size();
+    return true;
+}
+
+// 读取属性，存在有效日志时与存储文件合并
+static void pb_read_props(prop_cb *prop_cb) {
+    if (access(PERSIST_JOURNAL, F_OK) != 0) {
+        pb_get_prop(prop_cb);
+        return;
+    }
+    prop_list list;
+    prop_collector collector(list);
+    journal_header h{};
+    {
+        // 存储文件与日志必须来自同一次提交
+        file_lock lock(JOURNAL_LOCK);
+        auto m = pb_map(h);
+        pb_decode_props(m, &collector);
+        journal_merge(mmap_data(PERSIST_JOURNAL, persist_io), m, h, list);
+    }
+    for (auto &[key, val] : list)
+        prop_cb->exec(key.data(), val.data());
 }
 
 // 从文件格式获取单个属性
@@ -190,6 +624,17 @@ static bool file_get_prop(const char *name, char *value) {
     return value[0] != '\0';
 }
 
+// 以文件格式删除单个属性
+static bool file_delete_prop(const char *name) {
+    char path[4096];
+    ssprintf(path, sizeof(path), PERSIST_PROP_DIR "/%s", name);
+    if (unlink(path) == 0) {
+        LOGD("resetprop: unlink [%s]\n", path);
+        return true;
+    }
+    return false;
+}
+
 // 以文件格式设置单个属性
 static bool file_set_prop(const char *name, const char *value) {
     char tmp[4096];
@@ -209,6 +654,34 @@ static bool file_set_prop(const char *name, const char *value) {
     return rename(tmp, path) == 0;  // 原子性替换
 }
 
+// 跳过.、..以及file_set_prop留下的临时文件prop.XXXXXX
+static bool file_skip_name(const char *name) {
+    return name[0] == '.' ||
+           (str_starts(name, "prop.") && strlen(name) == sizeof("prop.XXXXXX") - 1);
+}
+
+// 读取传统格式目录中的所有属性，相对于目录fd用openat读取，省去逐个路径解析
+static void file_get_props(prop_cb *prop_cb) {
+    auto dir = open_dir(PERSIST_PROP_DIR);
+    if (!dir)
+        return;
+    int dfd = dirfd(dir.get());
+    char value[PROP_VALUE_MAX];
+    for (dirent *entry; (entry = readdir(dir.get()));) {
+        if (file_skip_name(entry->d_name))
+            continue;
+        int fd = openat(dfd, entry->d_name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        ssize_t len = read(fd, value, PROP_VALUE_MAX - 1);
+        close(fd);
+        if (len <= 0)
+            continue;
+        value[len] = '\0';
+        prop_cb->exec(entry->d_name, value);
+    }
+}
+
 // 检查是否使用protobuf格式
 static bool check_pb() {
     static bool use_pb = access(PERSIST_PROP, R_OK) == 0;
@@ -219,40 +692,51 @@ static bool check_pb() {
 void persist_get_props(prop_cb *prop_cb) {
     if (check_pb()) {
         // 使用protobuf格式
-        pb_get_prop(prop_cb);
+        pb_read_props(prop_cb);
     } else {
         // 使用传统文件格式
-        auto dir = open_dir(PERSIST_PROP_DIR);
-        if (!dir) return;
-        char value[PROP_VALUE_MAX];
-        for (dirent *entry; (entry = readdir(dir.get()));) {
-            if (file_get_prop(entry->d_name, value))
-                prop_cb->exec(entry->d_name, value);
-        }
+        file_get_props(prop_cb);
     }
 }
 
 // 匹配属性名称的回调类
 struct match_prop_name : prop_cb {
-    explicit match_prop_name(const char *name) : _name(name) { value[0] = '\0'; }
+    explicit match_prop_name(const char *name) : _name(name) {}
     void exec(const char *name, const char *val) override {
-        if (value[0] == '\0' && _name == name)
-            strscpy(value, val, sizeof(value));
+        if (value.empty() && _name == name)
+            value = val;
     }
-    char value[PROP_VALUE_MAX];
+    string value;
 private:
     string_view _name;
 };
 
+// 使用protobuf格式获取单个属性，没有日志时直接在映射的存储文件上查找
+static void pb_get_prop(const char *name, string &value) {
+    if (access(PERSIST_JOURNAL, F_OK) == 0) {
+        match_prop_name cb(name);
+        pb_read_props(&cb);
+        value = std::move(cb.value);
+        return;
+    }
+    mmap_data m(PERSIST_PROP, persist_io);
+    pb_foreach(m, [&](string_view n, string_view v) -> bool {
+        if (n != name)
+            return true;
+        value = v;
+        return false;
+    });
+}
+
 // 获取单个持久化属性
 void persist_get_prop(const char *name, prop_cb *prop_cb) {
     if (check_pb()) {
         // 使用protobuf格式
-        match_prop_name cb(name);
-        pb_get_prop(&cb);
-        if (cb.value[0]) {
-            LOGD("resetprop: get prop (persist) [%s]: [%s]\n", name, cb.value);
-            prop_cb->exec(name, cb.value);
+        string value;
+        pb_get_prop(name, value);
+        if (!value.empty()) {
+            LOGD("resetprop: get prop (persist) [%s]: [%s]\n", name, value.data());
+            prop_cb->exec(name, value.data());
         }
     } else {
         // 尝试从文件读取
@@ -264,44 +748,283 @@ void persist_get_prop(const char *name, prop_cb *prop_cb) {
     }
 }
 
-// 删除持久化属性
-bool persist_delete_prop(const char *name) {
+// 写入一批持久化属性的修改
+static bool persist_write(const persist_batch &batch) {
     if (check_pb()) {
         // 使用protobuf格式
-        prop_list list;
-        prop_collector collector(list);
-        pb_get_prop(&collector);
-
-        auto it = list.find(name);
-        if (it != list.end()) {
-            list.erase(it);
-            return pb_write_props(list);
-        }
-        return false;
-    } else {
-        // 使用传统文件格式
-        char path[4096];
-        ssprintf(path, sizeof(path), PERSIST_PROP_DIR "/%s", name);
-        if (unlink(path) == 0) {
-            LOGD("resetprop: unlink [%s]\n", path);
+        size_t size;
+        if (!journal_append(batch, size))
+            return false;
+        if (use_journal && size < JOURNAL_COMPACT_SIZE)
             return true;
+        return persist_compact();
+    }
+    // 使用传统文件格式
+    bool ret = true;
+    for (auto &[name, value] : batch) {
+        if (!(value ? file_set_prop(name.data(), value->data()) : file_delete_prop(name.data())))
+            ret = false;
+    }
+    return ret;
+}
+
+// 启用审计时记录持久化属性的修改，修改前的值需要在写入前读取
+struct persist_audit {
+    explicit persist_audit(const persist_batch &batch) : batch(batch) {
+        if (!audit_enabled())
+            return;
+        enabled = true;
+        if (batch.size() == 1) {
+            match_prop_name cb(batch[0].first.data());
+            persist_get_prop(batch[0].first.data(), &cb);
+            old.emplace(batch[0].first, std::move(cb.value));
+        } else {
+            prop_collector collector(old);
+            persist_get_props(&collector);
         }
     }
-    return false;
+    void commit() {
+        if (!enabled)
+            return;
+        for (auto &[name, value] : batch) {
+            auto it = old.find(name);
+            audit_record(audit_path::persist, name.data(), it == old.end() ? "" : it->second.data(),
+                         value ? value->data() : nullptr);
+            // 同一批中的后续修改以这次修改后的值为准
+            if (value)
+                old[name] = *value;
+            else if (it != old.end())
+                old.erase(it);
+        }
+    }
+private:
+    const persist_batch &batch;
+    prop_list old;
+    bool enabled = false;
+};
+
+// 批量修改持久化属性：protobuf格式下整批写入日志后只提交一次
+bool persist_apply(const persist_batch &batch) {
+    if (batch.empty())
+        return true;
+    persist_audit audit(batch);
+    bool ret = persist_write(batch);
+    if (ret)
+        audit.commit();
+    return ret;
 }
 
-// 设置持久化属性
-bool persist_set_prop(const char *name, const char *value) {
+// 删除持久化属性
+bool persist_delete_prop(const char *name) {
     if (check_pb()) {
         // 使用protobuf格式
-        prop_list list;
-        prop_collector collector(list);
-        pb_get_prop(&collector);
-        list[name] = value;
-        return pb_write_props(list);
-    } else {
-        // 使用传统文件格式
-        return file_set_prop(name, value);
+        string value;
+        pb_get_prop(name, value);
+        if (value.empty())
+            return false;
+    }
+    return persist_apply({{ name, nullopt }});
+}
+
+// 设置持久化属性
+bool persist_set_prop(const char *name, const char *value) {
+    return persist_apply({{ name, value }});
+}
+
+// 将日志中的记录合并回存储文件，调用者需持有PERSIST_LOCK。
+// 返回-1表示失败，1表示编码期间存储文件或日志被其他进程替换需要重试
+static int pb_commit() {
+    persist_changes changes;
+    journal_header h{}, jh{};
+    size_t end;
+    mmap_data m;
+    {
+        file_lock lock(JOURNAL_LOCK);
+        mmap_data j(PERSIST_JOURNAL, persist_io);
+        m = pb_map(h);
+        end = journal_changes(j, m, h, changes);
+        // 没有待提交的记录（已被之前的提交者合并）时直接返回；
+        // 无法解析的日志不含有效记录，留给下一次追加时重写
+        if (end <= sizeof(journal_header))
+            return 0;
+        journal_head(j, jh);
+    }
+
+    // 重写期间存储文件的映射保持有效，rename替换不影响已映射的数据
+    LOGD("resetprop: commit journal [" PERSIST_JOURNAL "]\n");
+    char tmp[4096];
+    if (!pb_rewrite_props(m, changes, tmp, sizeof(tmp)))
+        return -1;
+
+    file_lock lock(JOURNAL_LOCK);
+    mmap_data j(PERSIST_JOURNAL, persist_io);
+    journal_header cur{};
+    size_t valid = journal_replay(j);
+    if (valid < end || !journal_head(j, cur) || memcmp(&cur, &jh, sizeof(jh)) != 0) {
+        // 日志在编码期间被替换
+        unlink(tmp);
+        return 1;
+    }
+    journal_header now{};
+    journal_base(now);
+    if (memcmp(&now, &h, sizeof(h)) != 0) {
+        // 编码期间init重写了存储文件，在新的存储文件上重新提交，避免覆盖init的修改
+        unlink(tmp);
+        return 1;
+    }
+
+    // 编码期间追加的记录转移到新存储文件对应的日志中，它们修改前的值已包含本次合并的结果。
+    // rename保留inode和修改时间，新日志在替换存储文件之前就以同一代的日志头写好，
+    // 两次rename都在JOURNAL_LOCK内完成。在两次rename之间崩溃时，
+    // 旧日志与新存储文件不匹配，按修改前的值重放，追加的记录不会丢失
+    struct stat st{};
+    journal_header next{};
+    char jtmp[4096];
+    if (stat(tmp, &st) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    journal_base(st, next);
+    if (!journal_prepare(next, byte_view(j.buf() + end, valid - end), jtmp, sizeof(jtmp))) {
+        unlink(tmp);
+        return -1;
+    }
+    if (rename(tmp, PERSIST_PROP) != 0) {  // 原子性替换
+        unlink(tmp);
+        if (jtmp[0])
+            unlink(jtmp);
+        return -1;
+    }
+    if (!jtmp[0])
+        return unlink(PERSIST_JOURNAL) == 0 || errno == ENOENT ? 0 : -1;
+    if (rename(jtmp, PERSIST_JOURNAL) != 0) {
+        unlink(jtmp);
+        return -1;
+    }
+    return 0;
+}
+
+// 将日志中所有待提交的记录合并回存储文件（组提交）
+bool persist_compact() {
+    if (!check_pb())
+        return true;
+    file_lock commit(PERSIST_LOCK);
+    if (!commit.locked())
+        return false;
+    int ret;
+    while ((ret = pb_commit()) > 0);
+    return ret == 0;
+}
+
+/* ***************************
+ * 监视存储的修改
+ * ***************************/
+
+#define WATCH_SETTLE_MS  50  // 收到事件后再等待一段时间，把连续的修改合并为一次比较
+
+// 比较新旧两份属性列表，回调发生变化的属性；回调返回false时停止
+static bool diff_props(const prop_list &old, const prop_list &cur,
+                       const function<bool(const char *, const char *)> &fn) {
+    auto a = old.begin();
+    auto b = cur.begin();
+    while (a != old.end() || b != cur.end()) {
+        if (b == cur.end() || (a != old.end() && a->first < b->first)) {
+            if (!fn(a->first.data(), nullptr))
+                return false;
+            ++a;
+        } else if (a == old.end() || b->first < a->first) {
+            if (!fn(b->first.data(), b->second.data()))
+                return false;
+            ++b;
+        } else {
+            if (a->second != b->second && !fn(b->first.data(), b->second.data()))
+                return false;
+            ++a;
+            ++b;
+        }
+    }
+    return true;
+}
+
+// 用inotify监视存储目录，只回调发生变化的属性。
+// protobuf格式下存储文件被rename替换或日志被追加时重新读取并与缓存比较；
+// 传统格式下只重新读取发生变化的文件
+bool persist_watch(const function<bool(const char *name, const char *value)> &fn) {
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd < 0)
+        return false;
+    run_finally g([=] { close(ifd); });
+    if (inotify_add_watch(ifd, PERSIST_PROP_DIR,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0)
+        return false;
+
+    // 先建立监视再读取，不会漏掉两者之间的修改
+    bool pb = check_pb();
+    prop_list cache;
+    prop_collector collector(cache);
+    persist_get_props(&collector);
+
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        bool reload = false;
+        vector<string> names;
+        // 收到第一批事件后继续读取，直到WATCH_SETTLE_MS内没有新的事件
+        for (int timeout = -1;; timeout = WATCH_SETTLE_MS) {
+            pollfd pfd = { ifd, POLLIN, 0 };
+            int r = poll(&pfd, 1, timeout);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                return false;
+            if (r == 0)
+                break;
+            ssize_t n = read(ifd, buf, sizeof(buf));
+            if (n <= 0)
+                return false;
+            for (ssize_t off = 0; off < n;) {
+                auto e = reinterpret_cast<inotify_event *>(buf + off);
+                off += sizeof(inotify_event) + e->len;
+                if (e->mask & IN_IGNORED)  // 存储目录已被删除
+                    return false;
+                if (e->mask & IN_Q_OVERFLOW) {
+                    reload = true;
+                } else if (e->len == 0) {
+                    continue;
+                } else if (pb) {
+                    reload |= e->name == string_view(PERSIST_PROP_NAME) ||
+                              e->name == string_view(PERSIST_PROP_NAME ".journal");
+                } else if (!file_skip_name(e->name)) {
+                    names.emplace_back(e->name);
+                }
+            }
+        }
+
+        if (reload) {
+            prop_list cur;
+            prop_collector c(cur);
+            persist_get_props(&c);
+            if (!diff_props(cache, cur, fn))
+                return true;
+            cache.swap(cur);
+            continue;
+        }
+
+        sort(names.begin(), names.end());
+        names.erase(unique(names.begin(), names.end()), names.end());
+        for (auto &name : names) {
+            char value[PROP_VALUE_MAX];
+            auto it = cache.find(name);
+            if (file_get_prop(name.data(), value)) {
+                if (it != cache.end() && it->second == value)
+                    continue;
+                cache[name] = value;
+                if (!fn(name.data(), value))
+                    return true;
+            } else if (it != cache.end()) {
+                cache.erase(it);
+                if (!fn(name.data(), nullptr))
+                    return true;
+            }
+        }
     }
 }
-	
\ No newline at end of file
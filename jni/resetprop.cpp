@@ -1,11 +1,21 @@
 // 系统属性操作工具实现
 #include <dlfcn.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "logging.h"
-#include "resetprop.hpp"
+#include "resetprop_impl.hpp"
 
 #include <system_properties/prop_info.h>
 
@@ -28,80 +38,54 @@ static void (*system_property_read_callback)(
 static int (*system_property_foreach)(void (*)(const prop_info*, void*), void*);
 #endif
 
-// 属性操作标志位结构体
-struct PropFlags {
-    void setSkipSvc() { flags |= 1; }  // 跳过property_service
-    void setPersist() { flags |= (1 << 1); }  // 持久化属性
-    void setContext() { flags |= (1 << 2); }  // 获取SELinux上下文
-    void setPersistOnly() { flags |= (1 << 3); setPersist(); }  // 仅处理持久化属性
-    bool isSkipSvc() const { return flags & 1; }
-    bool isPersist() const { return flags & (1 << 1); }
-    bool isContext() const { return flags & (1 << 2); }
-    bool isPersistOnly() const { return flags & (1 << 3); }
-private:
-    uint32_t flags = 0;
-};
-
-// 显示使用帮助信息
-[[noreturn]] static void usage(char* arg0) {
-    fprintf(stderr,
-R"EOF(resetprop - System Property Manipulation Tool
-
-Usage: %s [flags] [arguments...]
+// 是否向stderr输出详细信息
+bool verbose = false;
 
-Read mode arguments:
-   (no arguments)    print all properties
-   NAME              get property
-
-Write mode arguments:
-   NAME VALUE        set property NAME as VALUE
-   -f,--file   FILE  load and set properties from FILE
-   -d,--delete NAME  delete property
-
-General flags:
-   -h,--help         show this message
-   -v                print verbose output to stderr
-
-Read mode flags:
-   -p      also read persistent props from storage
-   -P      only read persistent props from storage
-   -Z      get property context instead of value
+// 属性名称的字符分类表
+enum : uint8_t {
+    NAME_ILLEGAL = 0,
+    NAME_CHAR = 1,  // 字母数字、减号、@、冒号或下划线
+    NAME_DOT = 2,
+};
+static constexpr auto name_char_class = [] {
+    array<uint8_t, 256> t{};
+    for (int c = 'a'; c <= 'z'; ++c) t[c] = NAME_CHAR;
+    for (int c = 'A'; c <= 'Z'; ++c) t[c] = NAME_CHAR;
+    for (int c = '0'; c <= '9'; ++c) t[c] = NAME_CHAR;
+    t['_'] = t['-'] = t['@'] = t[':'] = NAME_CHAR;
+    t['.'] = NAME_DOT;
+    return t;
+}();
 
-Write mode flags:
-   -n      set properties bypassing property_service
-   -N      set ro properties using property_service
-   -p      always write persistent prop changes to storage
+// 检查属性名称，合法时返回nullptr，否则返回原因
+const char *check_prop_name(string_view name) {
+    if (name.empty())
+        return "empty name";
+    if (name.front() == '.' || name.back() == '.')
+        return "name starts or ends with '.'";
+    uint8_t prev = NAME_ILLEGAL;
+    for (unsigned char c : name) {
+        uint8_t cls = name_char_class[c];
+        if (cls == NAME_ILLEGAL)
+            return "illegal character in name";
+        if (cls == NAME_DOT && prev == NAME_DOT)
+            return "consecutive '.' in name";
+        prev = cls;
+    }
+    return nullptr;
+}
 
-)EOF", arg0);
-    exit(1);
+// 检查属性值，只有ro属性可以超过PROP_VALUE_MAX
+const char *check_prop_value(string_view name, string_view value) {
+    if (value.length() >= PROP_VALUE_MAX && !str_starts(name, "ro."))
+        return "value too long for non-ro property";
+    return nullptr;
 }
 
 // 检查属性名称的合法性
-static bool check_legal_property_name(const char *name) {
-    int namelen = strlen(name);
-
-    if (namelen < 1) goto illegal;  // 长度不能为0
-    if (name[0] == '.') goto illegal;  // 不能以点开头
-    if (name[namelen - 1] == '.') goto illegal;  // 不能以点结尾
-
-    /* 只允许字母数字、点、减号、@、冒号或下划线 */
-    /* 不允许连续的两个点出现在属性名中 */
-    for (size_t i = 0; i < namelen; i++) {
-        if (name[i] == '.') {
-            // i=0 保证永远不会有点。见上面的检查。
-            if (name[i-1] == '.') goto illegal;  // 不允许连续的点
-            continue;
-        }
-        if (name[i] == '_' || name[i] == '-' || name[i] == '@' || name[i] == ':') continue;
-        if (name[i] >= 'a' && name[i] <= 'z') continue;
-        if (name[i] >= 'A' && name[i] <= 'Z') continue;
-        if (name[i] >= '0' && name[i] <= '9') continue;
-        goto illegal;
-    }
-
-    return true;
-
-illegal:
+bool check_legal_property_name(const char *name) {
+    if (check_prop_name(name) == nullptr)
+        return true;
     LOGE("Illegal property name: [%s]\n", name);
     return false;
 }
@@ -134,52 +118,160 @@ struct prop_to_string : prop_cb {
     StringType val;
 };
 
-// 设置系统属性
-static int set_prop(const char *name, const char *value, PropFlags flags) {
-    if (!check_legal_property_name(name))
-        return 1;
+// 只读属性删除后重新添加的统计
+static struct {
+    size_t recreated;  // 删除后重新添加的次数
+    size_t bytes;      // 重新添加时在属性区域中新分配的字节数
+} ro_stats;
 
-    const char *msg = flags.isSkipSvc() ? "direct modification" : "property_service";
+// -v时输出只读属性的重新添加统计。属性区域只增不减，删除的旧节点不会回收，这些字节是额外的占用
+static void report_ro_stats() {
+    if (verbose && ro_stats.recreated) {
+        fprintf(stderr, "ro props recreated: %zu, extra area bytes consumed: %zu\n",
+                ro_stats.recreated, ro_stats.bytes);
+    }
+}
 
-    auto pi = const_cast<prop_info *>(__system_property_find(name));
+// 重新添加属性时在属性区域中分配的字节数，来源：bionic prop_area::new_prop_info
+static size_t prop_alloc_size(const char *name, size_t len) {
+    auto align = [](size_t n) { return (n + 3) & ~size_t(3); };
+    size_t sz = align(sizeof(prop_info) + strlen(name) + 1);
+    if (len >= PROP_VALUE_MAX)
+        sz += align(len + 1);
+    return sz;
+}
 
-    // 总是删除现有的只读属性，因为它们可能是长属性，
-    // 不能直接通过__system_property_update更新
-    if (pi != nullptr && str_starts(name, "ro.") && (!flags.isSkipSvc() || flags.isSkipSvc() && pi->is_long())) {
-        // 跳过修剪节点，因为我们会尽快添加回来
-        __system_property_delete(name, false);
-        pi = nullptr;
+static const char *plan_op_name(plan_op op) {
+    switch (op) {
+    case plan_op::create: return "create";
+    case plan_op::update: return "update";
+    case plan_op::noop: return "no-op";
+    case plan_op::ro_recreate: return "ro-recreate";
+    case plan_op::persist_only: return "persist-only";
+    case plan_op::invalid: return "invalid";
+    }
+    return "";
+}
+
+// 根据当前属性区域和持久化存储决定如何设置属性，不做任何写入。
+// store为nullptr时不读取持久化存储，视为需要写入；checked表示名称和值已经检查过
+plan_entry plan_prop(string name, string value, PropFlags flags, const prop_list *store,
+                     bool checked) {
+    plan_entry e;
+    e.name = std::move(name);
+    e.value = std::move(value);
+    e.direct = flags.isSkipSvc();
+    if (!checked && (e.reason = check_prop_name(e.name) ?: check_prop_value(e.name, e.value)))
+        return e;
+
+    e.pi = const_cast<prop_info *>(__system_property_find(e.name.data()));
+    size_t len = e.value.length();
+    if (e.pi == nullptr) {
+        e.op = plan_op::create;
+        e.bytes = prop_alloc_size(e.name.data(), len);
+    } else {
+        prop_to_string<string> cur;
+        read_prop_with_cb(e.pi, &cur);
+        e.old = std::move(cur.val);
+        bool ro = str_starts(e.name, "ro.");
+        if (e.old == e.value) {
+            // 只有直接修改时跳过；通过property_service时仍然提交，init的on property触发器依赖每次设置
+            e.op = plan_op::noop;
+            if (!e.direct && ro)
+                e.bytes = prop_alloc_size(e.name.data(), len);
+        } else if (!ro) {
+            e.op = plan_op::update;
+        } else if (e.direct && !e.pi->is_long() && len < PROP_VALUE_MAX) {
+            // 短属性改为短值，通过__system_property_update原地更新
+            e.op = plan_op::update;
+        } else {
+            // property_service不能修改已存在的只读属性。长属性的值没有序列号保护，
+            // 读取者直接读取，无法安全地原地修改，也只能删除后重新添加
+            e.op = plan_op::ro_recreate;
+            e.bytes = prop_alloc_size(e.name.data(), len);
+        }
     }
 
-    int ret;
-    if (pi != nullptr) {
+    // 当绕过property_service时，持久化属性不会存储在存储中，需要显式写入
+    if (e.direct && flags.isPersist() && str_starts(e.name, "persist.")) {
+        auto it = store ? store->find(e.name) : prop_list::const_iterator();
+        e.persist = store == nullptr || it == store->end() || it->second != e.value;
+        if (e.persist && e.op == plan_op::noop)
+            e.op = plan_op::persist_only;
+    }
+    return e;
+}
+
+// 执行修改计划中的一项，不包括持久化存储的写入
+static int apply_prop(const plan_entry &e) {
+    const char *name = e.name.data();
+    const char *value = e.value.data();
+    const char *msg = e.direct ? "direct modification" : "property_service";
+    size_t len = e.value.length();
+
+    int ret = 0;
+    switch (e.op) {
+    case plan_op::invalid:
+        LOGE("Illegal property: [%s]: %s\n", name, e.reason);
+        return 1;
+    case plan_op::noop:
+        if (!e.direct) {
+            // 与ro_recreate相同，只读属性需先删除才能通过property_service重新设置
+            if (str_starts(name, "ro."))
+                __system_property_delete(name, false);
+            ret = system_property_set(name, value);
+            LOGD("resetprop: resend prop [%s]: [%s] by %s\n", name, value, msg);
+            break;
+        }
+        [[fallthrough]];
+    case plan_op::persist_only:
+        LOGD("resetprop: prop [%s] unchanged\n", name);
+        return 0;
+    case plan_op::update:
         // 更新现有属性
-        if (flags.isSkipSvc()) {
-            ret = __system_property_update(pi, value, strlen(value));
+        if (e.direct) {
+            ret = __system_property_update(e.pi, value, len);
         } else {
             ret = system_property_set(name, value);
         }
         LOGD("resetprop: update prop [%s]: [%s] by %s\n", name, value, msg);
-    } else {
+        break;
+    case plan_op::ro_recreate:
+        // 跳过修剪节点，因为我们会尽快添加回来
+        __system_property_delete(name, false);
+        ++ro_stats.recreated;
+        ro_stats.bytes += e.bytes;
+        [[fallthrough]];
+    case plan_op::create:
         // 创建新属性
-        if (flags.isSkipSvc()) {
-            ret = __system_property_add(name, strlen(name), value, strlen(value));
+        if (e.direct) {
+            ret = __system_property_add(name, e.name.length(), value, len);
         } else {
             ret = system_property_set(name, value);
         }
         LOGD("resetprop: create prop [%s]: [%s] by %s\n", name, value, msg);
+        break;
     }
+    if (ret == 0)
+        audit_record(e.direct ? audit_path::direct : audit_path::service, name, e.old.data(), value);
+    return ret;
+}
 
-    // 当绕过property_service时，持久化属性不会存储在存储中。
-    // 显式处理这种情况。
-    if (ret == 0 && flags.isSkipSvc() && flags.isPersist() && str_starts(name, "persist.")) {
-        ret = persist_set_prop(name, value) ? 0 : 1;
+// 设置系统属性，名称和值只在这里检查一次
+int set_prop(const char *name, const char *value, PropFlags flags) {
+    if (!check_legal_property_name(name))
+        return 1;
+    if (auto reason = check_prop_value(name, value)) {
+        LOGE("Illegal property value for [%s]: %s\n", name, reason);
+        return 1;
     }
-
+    auto e = plan_prop(name, value, flags, nullptr, true);
+    int ret = apply_prop(e);
+    if (ret == 0 && e.persist)
+        ret = persist_set_prop(name, value) ? 0 : 1;
     if (ret) {
         LOGW("resetprop: set prop error\n");
     }
-
     return ret;
 }
 
@@ -216,16 +308,35 @@ static StringType get_prop(const char *name, PropFlags flags) {
     return cb.val;
 }
 
-// 打印所有属性
-static void print_props(PropFlags flags) {
+string get_prop(const char *name, PropFlags flags) {
+    return get_prop<string>(name, flags);
+}
+
+// 在枚举过程中过滤属性，只有名称和值都匹配的属性才会交给下一个回调
+struct prop_filter : prop_cb {
+    prop_filter(const prop_matcher &names, const prop_matcher &values, prop_cb &next)
+    : names(names), values(values), next(next) {}
+    void exec(const char *name, const char *value) override {
+        if (names.match(name) && values.match(value))
+            next.exec(name, value);
+    }
+private:
+    const prop_matcher &names;
+    const prop_matcher &values;
+    prop_cb &next;
+};
+
+// 打印所有（匹配的）属性，过滤时没有匹配的属性返回1
+int print_props(PropFlags flags, const prop_matcher &names, const prop_matcher &values) {
     prop_list list;
     prop_collector collector(list);
+    prop_filter filter(names, values, collector);
     // 如果不是仅处理持久化属性，先收集系统属性
     if (!flags.isPersistOnly())
-        system_property_foreach(read_prop_with_cb, &collector);
+        system_property_foreach(read_prop_with_cb, &filter);
     // 如果需要处理持久化属性，收集持久化属性
     if (flags.isPersist())
-        persist_get_props(&collector);
+        persist_get_props(&filter);
     // 打印所有收集到的属性
     for (auto &[key, val] : list) {
         const char *v = flags.isContext() ?
@@ -233,16 +344,24 @@ static void print_props(PropFlags flags) {
                 val.data();
         printf("[%s]: [%s]\n", key.data(), v);
     }
+    return list.empty() && !(names.empty() && values.empty()) ? 1 : 0;
 }
 
 // 删除系统属性
-static int delete_prop(const char *name, PropFlags flags) {
+int delete_prop(const char *name, PropFlags flags) {
     if (!check_legal_property_name(name))
         return 1;
 
     LOGD("resetprop: delete prop [%s]\n", name);
 
+    prop_to_string<string> old;
+    if (audit_enabled()) {
+        if (auto pi = system_property_find(name))
+            read_prop_with_cb(pi, &old);
+    }
     int ret = __system_property_delete(name, true);
+    if (ret == 0)
+        audit_record(audit_path::direct, name, old.val.data(), nullptr);
     // 如果是持久化属性，也需要从持久化存储中删除
     if (flags.isPersist() && str_starts(name, "persist.")) {
         if (persist_delete_prop(name))
@@ -252,149 +371,698 @@ static int delete_prop(const char *name, PropFlags flags) {
     return ret;
 }
 
-// 从文件加载属性
-static void load_file(const char *filename, PropFlags flags) {
-    LOGD("resetprop: Parse prop file [%s]\n", filename);
-    parse_prop_file(filename, [=](auto key, auto val) -> bool {
-        set_prop(key.data(), val.data(), flags);
-        return true;
-    });
+// 检查property_service是否支持SETPROP2协议（Android O及以上）
+static bool svc_pipeline_supported() {
+    prop_to_string<string> cb;
+    if (auto pi = system_property_find("ro.property_service.version"))
+        read_prop_with_cb(pi, &cb);
+    return cb.val == "2";
 }
 
-// 初始化结构体，用于一次性初始化
-struct Initialize {
-    Initialize() {
-#ifndef APPLET_STUB_MAIN
-#define DLOAD(name) (*(void **) &name = dlsym(RTLD_DEFAULT, "__" #name))
-        // 加载平台实现的函数
-        DLOAD(system_property_set);
-        DLOAD(system_property_read);
-        DLOAD(system_property_find);
-        DLOAD(system_property_read_callback);
-        DLOAD(system_property_foreach);
-#undef DLOAD
-#endif
-        // 初始化系统属性
-        if (__system_properties_init()) {
-            LOGE("resetprop: __system_properties_init error\n");
+// 合并后的属性表：保留每个属性首次出现的位置，值以最后一次出现为准
+struct merged_props {
+    void set(string_view key, string_view val) {
+        auto [it, inserted] = index.try_emplace(string(key), entries.size());
+        if (inserted)
+            entries.emplace_back(key, val);
+        else
+            entries[it->second].second = val;
+    }
+    vector<pair<string, string>> entries;
+private:
+    unordered_map<string, size_t> index;
+};
+
+// 展开属性文件列表，目录按文件名的字典序展开为其中的文件
+static vector<string> expand_prop_files(const vector<const char *> &paths) {
+    vector<string> files;
+    for (auto path : paths) {
+        struct stat st{};
+        if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+            files.emplace_back(path);
+            continue;
+        }
+        auto dir = open_dir(path);
+        if (!dir) continue;
+        vector<string> names;
+        for (dirent *entry; (entry = readdir(dir.get()));) {
+            if (entry->d_name[0] != '.')
+                names.emplace_back(entry->d_name);
+        }
+        sort(names.begin(), names.end());
+        for (auto &name : names) {
+            string file = string(path) + "/" + name;
+            if (stat(file.data(), &st) == 0 && S_ISREG(st.st_mode))
+                files.push_back(std::move(file));
+        }
+    }
+    return files;
+}
+
+// 并行解析多个属性文件，再按文件顺序合并，同名属性后出现的覆盖先出现的
+static merged_props parse_prop_files(const vector<string> &files) {
+    vector<vector<pair<string, string>>> parsed(files.size());
+    atomic_size_t next = 0;
+    auto worker = [&] {
+        for (size_t i; (i = next++) < files.size();) {
+            LOGD("resetprop: Parse prop file [%s]\n", files[i].data());
+            auto fn = [&](string_view key, string_view val) -> bool {
+                parsed[i].emplace_back(key, val);
+                return true;
+            };
+            if (files[i] == "-")
+                parse_prop_file(stdin, fn);
+            else
+                parse_prop_file(files[i].data(), fn);
         }
+    };
+    size_t n = min<size_t>({ files.size(), thread::hardware_concurrency(), 4 });
+    vector<thread> threads;
+    for (size_t i = 1; i < n; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+
+    merged_props props;
+    for (auto &file : parsed) {
+        for (auto &[key, val] : file)
+            props.set(key, val);
+    }
+    return props;
+}
+
+// 在任何写入之前为整批属性生成修改计划，不合法的属性同样列入计划
+vector<plan_entry> plan_props(vector<pair<string, string>> &entries, PropFlags flags,
+                              bool checked) {
+    prop_list store;
+    bool read_store = flags.isSkipSvc() && flags.isPersist();
+    if (read_store) {
+        prop_collector collector(store);
+        persist_get_props(&collector);
     }
+    vector<plan_entry> plan;
+    plan.reserve(entries.size());
+    for (auto &[key, val] : entries)
+        plan.push_back(plan_prop(std::move(key), std::move(val), flags,
+                                 read_store ? &store : nullptr, checked));
+    return plan;
+}
+
+// 一次性报告所有不合法的属性
+static size_t report_errors(const vector<prop_error> &errors, const char *action) {
+    if (errors.empty())
+        return 0;
+    LOGW("resetprop: %zu invalid properties %s\n", errors.size(), action);
+    fprintf(stderr, "%zu invalid properties %s:\n", errors.size(), action);
+    for (auto &e : errors)
+        fprintf(stderr, "  [%s]: %s\n", e.name.data(), e.reason);
+    return errors.size();
+}
+
+// 报告计划中所有不合法的属性
+static size_t report_errors(const vector<plan_entry> &plan) {
+    vector<prop_error> errors;
+    for (auto &e : plan) {
+        if (e.op == plan_op::invalid)
+            errors.push_back({ e.name, e.reason });
+    }
+    return report_errors(errors, "skipped");
+}
+
+// 打印修改计划及其开销
+static void print_plan(const vector<plan_entry> &plan) {
+    size_t counts[(int) plan_op::invalid + 1] = {};
+    size_t bytes = 0;
+    for (auto &e : plan) {
+        ++counts[(int) e.op];
+        bytes += e.bytes;
+        if (e.op == plan_op::invalid) {
+            printf("[%s]: [%s] invalid: %s\n", e.name.data(), e.value.data(), e.reason);
+            continue;
+        }
+        printf("[%s]: [%s] %s by %s%s, %zu bytes\n", e.name.data(), e.value.data(),
+               e.op == plan_op::noop && !e.direct ? "no-op (resent)" : plan_op_name(e.op), e.direct ? "direct modification" : "property_service",
+               e.persist ? " + persist storage" : "", e.bytes);
+    }
+    printf("%zu create, %zu update, %zu no-op, %zu ro-recreate, %zu persist-only, %zu invalid, "
+           "%zu area bytes\n",
+           counts[(int) plan_op::create], counts[(int) plan_op::update],
+           counts[(int) plan_op::noop], counts[(int) plan_op::ro_recreate],
+           counts[(int) plan_op::persist_only], counts[(int) plan_op::invalid], bytes);
+}
+
+// 执行修改计划，返回设置失败的属性数
+int apply_plan(const vector<plan_entry> &plan, PropFlags flags) {
+    int failed = 0;
+    if (flags.isSkipSvc() || !svc_pipeline_supported()) {
+        // 属性区域的写入者只能有一个：全局序列号的递增不是原子操作，并发写入会使其回退。
+        // 持久化属性在全部设置完成后统一写入存储，只重写一次
+        persist_batch batch;
+        for (auto &e : plan) {
+            if (e.op == plan_op::invalid)
+                continue;
+            if (apply_prop(e)) {
+                ++failed;
+            } else if (e.persist) {
+                batch.emplace_back(e.name, e.value);
+            }
+        }
+        if (!persist_apply(batch)) {
+            LOGW("resetprop: write persist props error\n");
+            failed += batch.size();
+        }
+        report_ro_stats();
+        return failed;
+    }
+
+    // 通过property_service时，多个请求流水线并发提交
+    vector<svc_request> reqs;
+    vector<const plan_entry *> sent;
+    for (auto &e : plan) {
+        if (e.op != plan_op::invalid && e.op != plan_op::persist_only) {
+            reqs.push_back({ e.name, e.value, str_starts(e.name, "ro.") });
+            sent.push_back(&e);
+        }
+    }
+    failed += svc_set_props(reqs);
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        if (reqs[i].ret == 0)
+            audit_record(audit_path::service, reqs[i].name.data(), sent[i]->old.data(),
+                         reqs[i].value.data());
+    }
+    return failed;
+}
+
+/* ***************************
+ * 检查点与回滚
+ * ***************************/
+
+// 撤销文件格式：checkpoint_header | 记录... | CRC32
+// 每条记录为：checkpoint_record | 名称 | 原属性值 | 原持久化值
+#ifndef CHECKPOINT_DIR
+#define CHECKPOINT_DIR    "/data/adb/resetprop"
+#endif
+#define CHECKPOINT_MAGIC  0x31555052  // "RPU1"
+
+struct checkpoint_header {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t direct;  // 加载时是否绕过property_service，回滚时使用相同方式
+    uint32_t reserved;
 };
 
-// 确保只初始化一次
-static void InitOnce() {
-    static struct Initialize init;
+enum : uint8_t {
+    UNDO_LIVE = 1,             // 加载修改了系统属性
+    UNDO_LIVE_EXISTED = 2,     // 修改前系统属性存在
+    UNDO_PERSIST = 4,          // 加载修改了持久化存储
+    UNDO_PERSIST_EXISTED = 8,  // 修改前持久化存储中存在
+};
+
+struct checkpoint_record {
+    uint8_t flags;
+    uint8_t reserved[3];
+    uint32_t name_len;
+    uint32_t live_len;
+    uint32_t persist_len;
+};
+
+// 检查点名称直接用作文件名
+static bool checkpoint_path(const char *name, char *path, size_t size) {
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') || strlen(name) > 128) {
+        LOGE("resetprop: invalid checkpoint name [%s]\n", name);
+        return false;
+    }
+    ssprintf(path, size, CHECKPOINT_DIR "/%s.undo", name);
+    return true;
+}
+
+// 在设置之前记录计划会修改的每个属性原来的值或不存在，包括系统属性和持久化存储
+static bool write_checkpoint(const char *name, const vector<plan_entry> &plan, PropFlags flags) {
+    char path[4096];
+    if (!checkpoint_path(name, path, sizeof(path)))
+        return false;
+
+    prop_list store;
+    if (any_of(plan.begin(), plan.end(), [](auto &e) { return str_starts(e.name, "persist."); })) {
+        prop_collector collector(store);
+        persist_get_props(&collector);
+    }
+
+    checkpoint_header h{};
+    h.magic = CHECKPOINT_MAGIC;
+    h.direct = flags.isSkipSvc();
+    string buf((const char *) &h, sizeof(h));
+    for (auto &e : plan) {
+        bool live = e.op == plan_op::create || e.op == plan_op::update || e.op == plan_op::ro_recreate;
+        // 通过property_service设置persist.*属性时init也会写入持久化存储
+        bool persist = str_starts(e.name, "persist.") && (e.persist || (live && !e.direct));
+        if (!live && !persist)
+            continue;
+        checkpoint_record r{};
+        string_view persist_value;
+        if (live) {
+            r.flags |= UNDO_LIVE;
+            if (e.pi) {
+                r.flags |= UNDO_LIVE_EXISTED;
+                r.live_len = e.old.length();
+            }
+        }
+        if (persist) {
+            r.flags |= UNDO_PERSIST;
+            if (auto it = store.find(e.name); it != store.end()) {
+                r.flags |= UNDO_PERSIST_EXISTED;
+                persist_value = it->second;
+            }
+        }
+        r.name_len = e.name.length();
+        r.persist_len = persist_value.length();
+        buf.append((const char *) &r, sizeof(r));
+        buf.append(e.name);
+        buf.append(e.old, 0, r.live_len);
+        buf.append(persist_value);
+        ++h.count;
+    }
+    memcpy(buf.data(), &h, sizeof(h));
+    uint32_t crc = crc32_ieee(buf.data(), buf.size());
+    buf.append((const char *) &crc, sizeof(crc));
+
+    mkdir(CHECKPOINT_DIR, 0700);
+    char tmp[4096];
+    ssprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("resetprop: create checkpoint [%s]: %s\n", path, strerror(errno));
+        return false;
+    }
+    bool ok = write(fd, buf.data(), buf.size()) == buf.size() && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, path) != 0) {
+        LOGE("resetprop: write checkpoint [%s]: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+    LOGD("resetprop: checkpoint [%s] records %u props\n", name, h.count);
+    return true;
 }
 
-// 消费下一个参数的宏定义
-#define consume_next(val)    \
-if (argc != 2) usage(argv0); \
-val = argv[1];               \
-stop_parse = true;           \
+// 恢复检查点记录的所有属性：系统属性一次批量设置，持久化存储只重写一次。
+// 成功后删除撤销文件
+int rollback(const char *name) {
+    char path[4096];
+    if (!checkpoint_path(name, path, sizeof(path)))
+        return 1;
+    mmap_data m(path, mmap_data::io_mode::read);
+    checkpoint_header h{};
+    uint32_t crc = 0;
+    if (m.sz() >= sizeof(h) + sizeof(crc)) {
+        memcpy(&h, m.buf(), sizeof(h));
+        memcpy(&crc, m.buf() + m.sz() - sizeof(crc), sizeof(crc));
+    }
+    size_t end = m.sz() - sizeof(crc);
+    if (h.magic != CHECKPOINT_MAGIC || crc != crc32_ieee(m.buf(), end)) {
+        LOGE("resetprop: invalid checkpoint [%s]\n", path);
+        fprintf(stderr, "no valid checkpoint [%s]\n", name);
+        return 1;
+    }
+
+    vector<pair<string, string>> restore;
+    vector<string> remove;
+    persist_batch batch;
+    size_t off = sizeof(h);
+    for (uint32_t i = 0; i < h.count; ++i) {
+        checkpoint_record r{};
+        if (end - off < sizeof(r))
+            return 1;
+        memcpy(&r, m.buf() + off, sizeof(r));
+        off += sizeof(r);
+        if (end - off < (size_t) r.name_len + r.live_len + r.persist_len)
+            return 1;
+        auto p = (const char *) m.buf() + off;
+        string key(p, r.name_len);
+        off += (size_t) r.name_len + r.live_len + r.persist_len;
+        if (r.flags & UNDO_LIVE) {
+            if (r.flags & UNDO_LIVE_EXISTED)
+                restore.emplace_back(key, string(p + r.name_len, r.live_len));
+            else
+                remove.push_back(key);
+        }
+        if (r.flags & UNDO_PERSIST) {
+            if (r.flags & UNDO_PERSIST_EXISTED)
+                batch.emplace_back(key, string(p + r.name_len + r.live_len, r.persist_len));
+            else
+                batch.emplace_back(key, nullopt);
+        }
+    }
 
-// 主函数
-int main(int argc, char *argv[]) {
+    // 使用与加载时相同的方式恢复系统属性，持久化存储最后统一写入
     PropFlags flags;
-    char *argv0 = argv[0];
-    // set_log_level_state(LogLevel::Debug, false);
-
-    const char *prop_file = nullptr;
-    const char *prop_to_rm = nullptr;
-
-    --argc;
-    ++argv;
-
-    bool ro_use_svc = false;
-
-    // 解析标志和长选项
-    while (argc && argv[0][0] == '-') {
-        bool stop_parse = false;
-        for (int idx = 1; true; ++idx) {
-            switch (argv[0][idx]) {
-            case '-':
-                if (argv[0] == "--file"sv) {
-                    consume_next(prop_file);
-                } else if (argv[0] == "--delete"sv) {
-                    consume_next(prop_to_rm);
-                } else {
-                    usage(argv0);
-                }
-                break;
-            case 'd':
-                consume_next(prop_to_rm);
-                continue;
-            case 'f':
-                consume_next(prop_file);
-                continue;
-            case 'n':
-                flags.setSkipSvc();  // 绕过property_service
-                continue;
-            case 'p':
-                flags.setPersist();  // 处理持久化属性
-                continue;
-            case 'P':
-                flags.setPersistOnly();  // 仅处理持久化属性
-                continue;
-            case 'v':
-                // set_log_level_state(LogLevel::Debug, true);
-                continue;
-            case 'Z':
-                flags.setContext();  // 获取SELinux上下文
-                continue;
-            case 'N':
-                ro_use_svc = true;  // 只读属性使用property_service
-                continue;
-            case '\0':
+    if (h.direct)
+        flags.setSkipSvc();
+    size_t restored = restore.size();
+    auto plan = plan_props(restore, flags, true);
+    int failed = apply_plan(plan, flags);
+    for (auto &key : remove) {
+        if (__system_property_find(key.data()) && delete_prop(key.data(), PropFlags()))
+            ++failed;
+    }
+    if (!persist_apply(batch)) {
+        LOGW("resetprop: write persist props error\n");
+        failed += batch.size();
+    }
+    if (verbose) {
+        fprintf(stderr, "checkpoint [%s]: %zu props restored, %zu removed, %zu persist changes\n",
+                name, restored, remove.size(), batch.size());
+    }
+    if (failed == 0)
+        unlink(path);
+    return failed;
+}
+
+// 从文件加载属性，返回设置失败的属性数；plan_only时只打印修改计划，
+// 指定checkpoint时先记录被修改的属性原来的值
+int load_files(const vector<const char *> &paths, PropFlags flags, bool plan_only,
+               const char *checkpoint) {
+    auto start = chrono::steady_clock::now();
+    auto props = parse_prop_files(expand_prop_files(paths));
+    auto plan = plan_props(props.entries, flags);
+    if (plan_only) {
+        print_plan(plan);
+        return 0;
+    }
+    int failed = report_errors(plan);
+    if (checkpoint && !write_checkpoint(checkpoint, plan, flags)) {
+        fprintf(stderr, "cannot write checkpoint [%s], nothing applied\n", checkpoint);
+        return failed + 1;
+    }
+    failed += apply_plan(plan, flags);
+    if (verbose) {
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "loaded %zu props in %.1f ms, %.0f props/s\n",
+                plan.size(), ms, ms > 0 ? plan.size() * 1000 / ms : 0.0);
+    }
+    return failed;
+}
+
+#define STREAM_QUEUE_SIZE  1024  // 流水线队列的容量
+#define STREAM_SVC_CHUNK   64    // 通过property_service时每批提交的属性数
+
+// 解析线程读取并检查属性，经有界队列交给当前线程的apply，解析与设置重叠执行。
+// 队列暂时为空时先调用idle再等待；不合法的属性记录在errors中。返回设置的属性数
+size_t stream_props(FILE *fp, const function<void(stream_record &)> &apply,
+                    const function<void()> &idle, vector<prop_error> &errors) {
+    auto queue = make_unique<spsc_queue<stream_record, STREAM_QUEUE_SIZE>>();
+    thread parser([&] {
+        parse_prop_file(fp, [&](string_view key, string_view val) -> bool {
+            if (auto reason = check_prop_name(key) ?: check_prop_value(key, val))
+                errors.push_back({ string(key), reason });
+            else
+                queue->push({ string(key), string(val) });
+            return true;
+        });
+        queue->close();
+    });
+
+    size_t count = 0;
+    stream_record r;
+    for (;;) {
+        if (!queue->try_pop(r)) {
+            if (idle)
+                idle();
+            if (!queue->pop(r))
                 break;
-            default:
-                usage(argv0);
+        }
+        apply(r);
+        ++count;
+    }
+    parser.join();
+    return count;
+}
+
+// 从标准输入流式加载属性，同名属性按输入顺序设置，最后出现的生效。
+// 输入无法预先读完，因此不合法的属性被跳过，并在结束时一并报告
+int load_stream(PropFlags flags) {
+    auto start = chrono::steady_clock::now();
+    prop_list store;
+    bool read_store = flags.isSkipSvc() && flags.isPersist();
+    if (read_store) {
+        prop_collector collector(store);
+        persist_get_props(&collector);
+    }
+    bool use_svc = !flags.isSkipSvc() && svc_pipeline_supported();
+
+    int failed = 0;
+    persist_batch batch;
+    vector<svc_request> reqs;
+    vector<string> olds;  // 与reqs一一对应的修改前的值
+    unordered_set<string> pending;  // 尚未提交的请求，同名属性再次出现时须先提交才能正确判断
+    auto flush = [&] {
+        if (reqs.empty())
+            return;
+        failed += svc_set_props(reqs);
+        for (size_t i = 0; i < reqs.size(); ++i) {
+            if (reqs[i].ret == 0)
+                audit_record(audit_path::service, reqs[i].name.data(), olds[i].data(),
+                             reqs[i].value.data());
+        }
+        reqs.clear();
+        olds.clear();
+        pending.clear();
+    };
+
+    vector<prop_error> errors;
+    size_t count = stream_props(stdin, [&](stream_record &r) {
+        if (use_svc && pending.count(r.name))
+            flush();
+        auto e = plan_prop(std::move(r.name), std::move(r.value), flags,
+                           read_store ? &store : nullptr, true);
+        if (use_svc) {
+            if (e.op != plan_op::invalid && e.op != plan_op::persist_only) {
+                pending.insert(e.name);
+                olds.push_back(std::move(e.old));
+                bool ro = str_starts(e.name, "ro.");
+                reqs.push_back({ std::move(e.name), std::move(e.value), ro });
+                if (reqs.size() >= STREAM_SVC_CHUNK)
+                    flush();
             }
-            break;
+            return;
         }
-        --argc;
-        ++argv;
-        if (stop_parse)
-            break;
+        if (apply_prop(e)) {
+            ++failed;
+        } else if (e.persist) {
+            store[e.name] = e.value;
+            batch.emplace_back(std::move(e.name), std::move(e.value));
+        }
+    }, flush, errors);
+    flush();
+
+    if (!persist_apply(batch)) {
+        LOGW("resetprop: write persist props error\n");
+        failed += batch.size();
     }
+    failed += report_errors(errors, "skipped");
+    report_ro_stats();
+    if (verbose) {
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "streamed %zu props in %.1f ms, %.0f props/s\n",
+                count, ms, ms > 0 ? count * 1000 / ms : 0.0);
+    }
+    return failed;
+}
 
-    InitOnce();
+/* ***************************
+ * 预编译的属性包
+ * ***************************/
+
+// 文件格式：bundle_header | bundle_entry[count] | 字符串池
+// 字符串池中每个字符串为：uint32长度 | 内容 | '\0'，相同的字符串只存一份。
+// 属性在编译时已经检查、去重，并按上下文排序，同一属性区域的属性连续设置
+#define BUNDLE_MAGIC   0x31425052  // "RPB1"
+#define BUNDLE_MARKER  "/dev/.resetprop_bundle_%08x_%x"  // 本次启动以同样的标志成功应用过的属性包
+
+struct bundle_header {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t pool_size;
+    uint32_t hash;  // 属性表与字符串池的CRC32
+};
 
-    // 如果指定了要删除的属性
-    if (prop_to_rm) {
-        return delete_prop(prop_to_rm, flags);
+// 各字段为字符串池中的偏移
+struct bundle_entry {
+    uint32_t context;
+    uint32_t name;
+    uint32_t value;
+};
+
+// 将属性文件编译为属性包
+int compile_bundle(const vector<const char *> &paths, const char *out) {
+    auto props = parse_prop_files(expand_prop_files(paths));
+    vector<prop_error> errors;
+    for (auto &[key, val] : props.entries) {
+        if (auto reason = check_prop_name(key) ?: check_prop_value(key, val))
+            errors.push_back({ key, reason });
     }
+    if (report_errors(errors, "rejected"))
+        return 1;
 
-    // 如果指定了属性文件
-    if (prop_file) {
-        load_file(prop_file, flags);
-        return 0;
+    struct item {
+        string_view context;
+        const string *name;
+        const string *value;
+    };
+    vector<item> items;
+    items.reserve(props.entries.size());
+    for (auto &[key, val] : props.entries)
+        items.push_back({ __system_property_get_context(key.data()) ?: "", &key, &val });
+    sort(items.begin(), items.end(), [](const item &a, const item &b) {
+        return a.context != b.context ? a.context < b.context : *a.name < *b.name;
+    });
+
+    string pool;
+    unordered_map<string_view, uint32_t> interned;
+    auto intern = [&](string_view str) -> uint32_t {
+        auto [it, inserted] = interned.try_emplace(str, pool.size());
+        if (inserted) {
+            uint32_t len = str.length();
+            pool.append((const char *) &len, sizeof(len));
+            pool.append(str);
+            pool.push_back('\0');
+        }
+        return it->second;
+    };
+    vector<bundle_entry> entries;
+    entries.reserve(items.size());
+    for (auto &i : items)
+        entries.push_back({ intern(i.context), intern(*i.name), intern(*i.value) });
+
+    bundle_header h{};
+    h.magic = BUNDLE_MAGIC;
+    h.count = entries.size();
+    h.pool_size = pool.size();
+    h.hash = crc32_ieee(pool.data(), pool.size(),
+                        crc32_ieee(entries.data(), entries.size() * sizeof(bundle_entry)));
+
+    char tmp[4096];
+    ssprintf(tmp, sizeof(tmp), "%s.XXXXXX", out);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("resetprop: create bundle [%s]: %s\n", out, strerror(errno));
+        return 1;
+    }
+    size_t table = entries.size() * sizeof(bundle_entry);
+    bool ok = write(fd, &h, sizeof(h)) == sizeof(h) &&
+              write(fd, entries.data(), table) == table &&
+              write(fd, pool.data(), pool.size()) == pool.size();
+    close(fd);
+    if (!ok || rename(tmp, out) != 0) {
+        LOGE("resetprop: write bundle [%s]: %s\n", out, strerror(errno));
+        unlink(tmp);
+        return 1;
     }
+    if (verbose) {
+        fprintf(stderr, "compiled %u props into [%s], %zu bytes, hash %08x\n",
+                h.count, out, sizeof(h) + table + pool.size(), h.hash);
+    }
+    return 0;
+}
 
-    // 根据参数数量决定操作类型
-    switch (argc) {
-    case 0:
-        // 无参数：打印所有属性
-        print_props(flags);
-        return 0;
-    case 1: {
-        // 一个参数：获取指定属性值
-        auto val = get_prop<string>(argv[0], flags);
-        if (val.empty())
-            return 1;
-        printf("%s\n", val.data());
+// 读取字符串池中的字符串，越界或缺少终止符时返回nullptr
+static const char *bundle_string(byte_view pool, uint32_t off, uint32_t &len) {
+    if (pool.sz() < sizeof(len) || off > pool.sz() - sizeof(len))
+        return nullptr;
+    memcpy(&len, pool.buf() + off, sizeof(len));
+    size_t start = off + sizeof(len);
+    if (len >= pool.sz() - start || pool.buf()[start + len] != '\0')
+        return nullptr;
+    return (const char *) pool.buf() + start;
+}
+
+// 应用属性包，本次启动已经成功应用过相同内容时直接跳过
+int apply_bundle(const char *path, PropFlags flags) {
+    mmap_data m(path, mmap_data::io_mode::map);
+    bundle_header h{};
+    if (m.sz() >= sizeof(h))
+        memcpy(&h, m.buf(), sizeof(h));
+    // 先用文件大小限制count，避免32位上计算属性表大小时溢出
+    if (h.magic != BUNDLE_MAGIC || m.sz() < sizeof(h) ||
+        h.count > (m.sz() - sizeof(h)) / sizeof(bundle_entry)) {
+        LOGE("resetprop: invalid bundle [%s]\n", path);
+        return 1;
+    }
+    size_t table = (size_t) h.count * sizeof(bundle_entry);
+    if (h.pool_size != m.sz() - sizeof(h) - table) {
+        LOGE("resetprop: invalid bundle [%s]\n", path);
+        return 1;
+    }
+
+    // 以-n、-p、-P应用的结果不同，标记同时区分内容和标志
+    unsigned mode = flags.isSkipSvc() | flags.isPersist() << 1 | flags.isPersistOnly() << 2;
+    char marker[64];
+    ssprintf(marker, sizeof(marker), BUNDLE_MARKER, h.hash, mode);
+    if (access(marker, F_OK) == 0) {
+        LOGD("resetprop: bundle [%s] already applied\n", path);
         return 0;
     }
-    case 2: {
-        // 两个参数：设置属性
-        auto name = argv[0];
-        if (str_starts(name, "ro.") && !ro_use_svc) {
-            flags.setSkipSvc();  // 只读属性默认绕过property_service
+    if (crc32_ieee(m.buf() + sizeof(h), table + h.pool_size) != h.hash) {
+        LOGE("resetprop: corrupted bundle [%s]\n", path);
+        return 1;
+    }
+
+    byte_view pool(m.buf() + sizeof(h) + table, h.pool_size);
+    vector<pair<string, string>> entries;
+    entries.reserve(h.count);
+    for (uint32_t i = 0; i < h.count; ++i) {
+        bundle_entry b;
+        memcpy(&b, m.buf() + sizeof(h) + i * sizeof(b), sizeof(b));
+        uint32_t name_len, value_len;
+        auto name = bundle_string(pool, b.name, name_len);
+        auto value = bundle_string(pool, b.value, value_len);
+        if (name == nullptr || value == nullptr) {
+            LOGE("resetprop: corrupted bundle [%s]\n", path);
+            return 1;
         }
-        return set_prop(name, argv[1], flags);
+        entries.emplace_back(string(name, name_len), string(value, value_len));
     }
-    default:
-        usage(argv0);
+
+    // CRC只能发现损坏，无法防止篡改，属性名和值在应用前重新检查
+    vector<prop_error> errors;
+    for (auto &[key, val] : entries) {
+        if (auto reason = check_prop_name(key) ?: check_prop_value(key, val))
+            errors.push_back({ key, reason });
     }
+    if (report_errors(errors, "rejected"))
+        return 1;
+
+    auto plan = plan_props(entries, flags, true);
+    int failed = apply_plan(plan, flags);
+    if (failed == 0)
+        close(open(marker, O_WRONLY | O_CREAT | O_CLOEXEC, 0600));
+    return failed;
+}
+
+// 初始化结构体，用于一次性初始化
+struct Initialize {
+    Initialize() {
+#ifndef APPLET_STUB_MAIN
+#define DLOAD(name) (*(void **) &name = dlsym(RTLD_DEFAULT, "__" #name))
+        // 加载平台实现的函数
+        DLOAD(system_property_set);
+        DLOAD(system_property_read);
+        DLOAD(system_property_find);
+        DLOAD(system_property_read_callback);
+        DLOAD(system_property_foreach);
+#undef DLOAD
+#endif
+        // 初始化系统属性
+        if (__system_properties_init()) {
+            LOGE("resetprop: __system_properties_init error\n");
+        }
+    }
+};
+
+// 确保只初始化一次
+void InitOnce() {
+    static struct Initialize init;
 }
 
 /***************
@@ -436,5 +1104,5 @@ void load_prop_file(const char *filename, bool skip_svc) {
     InitOnce();
     PropFlags flags;
     if (skip_svc) flags.setSkipSvc();
-    load_file(filename, flags);
+    load_files({ filename }, flags);
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <optional>
 
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <api/_system_properties.h>
@@ -16,6 +18,9 @@ struct prop_cb {
 // 属性列表类型定义（名称->值的映射）
 using prop_list = std::map<std::string, std::string>;
 
+// 持久化属性的批量修改，值为空表示删除
+using persist_batch = std::vector<std::pair<std::string, std::optional<std::string>>>;
+
 // 属性收集器，用于将属性收集到列表中
 struct prop_collector : prop_cb {
     explicit prop_collector(prop_list &list) : list(list) {}
@@ -43,6 +48,40 @@ void persist_get_prop(const char *name, prop_cb *prop_cb);    // 获取单个持
 void persist_get_props(prop_cb *prop_cb);                    // 获取所有持久化属性
 bool persist_delete_prop(const char *name);                 // 删除持久化属性
 bool persist_set_prop(const char *name, const char *value); // 设置持久化属性
+bool persist_apply(const persist_batch &batch);             // 批量修改持久化属性
+void persist_use_journal(bool enable);                      // 启用日志模式写入
+bool persist_compact();                                     // 将日志合并回存储文件
+// 监视持久化存储，每次修改后回调发生变化的属性，值为nullptr表示已删除。
+// 回调返回false时返回true，无法监视或监视中断时返回false
+bool persist_watch(const std::function<bool(const char *name, const char *value)> &fn);
+
+// property_service流水线提交接口
+#define PROP_SERVICE_SOCKET "/dev/socket/property_service"
+struct svc_request {
+    std::string name;
+    std::string value;
+    bool recreate = false;  // 先删除现有属性再提交，用于只读属性
+    int ret = 0;  // 每个属性的提交结果
+};
+// 保持最多window个请求在途，返回失败的请求数。
+// recreate的请求要等之前的请求全部完成后才删除并提交，删除时不会与property_service同时写属性区域
+int svc_set_props(std::vector<svc_request> &reqs,
+                  const char *socket_path = PROP_SERVICE_SOCKET, int window = 8);
+
+// 属性修改审计接口，审计文件存在时所有修改都会记录到其中的环形缓冲区
+#ifndef AUDIT_FILE
+#define AUDIT_FILE "/dev/.resetprop_audit"
+#endif
+enum class audit_path : uint8_t {
+    direct = 1,   // 直接修改属性区域
+    service = 2,  // 通过property_service
+    persist = 3,  // 写入持久化存储
+};
+bool audit_enabled();        // 是否启用了审计
+bool audit_enable(bool enable);  // 创建或删除审计文件
+// 记录一次修改，new_value为nullptr表示删除
+void audit_record(audit_path path, const char *name, const char *old_value, const char *new_value);
+bool audit_dump(FILE *out);  // 按时间顺序输出审计记录
 
 // 字符串工具函数（来自misc.hpp）
 // 检查字符串是否包含子串
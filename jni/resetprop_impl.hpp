@@ -0,0 +1,164 @@
+// resetprop内部接口，供命令行入口和基准测试使用
+#pragma once
+
+#include <regex.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "resetprop.hpp"
+
+// 是否向stderr输出详细信息
+extern bool verbose;
+
+// 属性操作标志位结构体
+struct PropFlags {
+    void setSkipSvc() { flags |= 1; }  // 跳过property_service
+    void setPersist() { flags |= (1 << 1); }  // 持久化属性
+    void setContext() { flags |= (1 << 2); }  // 获取SELinux上下文
+    void setPersistOnly() { flags |= (1 << 3); setPersist(); }  // 仅处理持久化属性
+    bool isSkipSvc() const { return flags & 1; }
+    bool isPersist() const { return flags & (1 << 1); }
+    bool isContext() const { return flags & (1 << 2); }
+    bool isPersistOnly() const { return flags & (1 << 3); }
+private:
+    uint32_t flags = 0;
+};
+
+// 修改计划中每个属性的操作
+enum class plan_op : uint8_t {
+    create,        // 新建属性
+    update,        // 更新现有属性
+    noop,          // 值没有变化
+    ro_recreate,   // 删除只读属性后重新添加
+    persist_only,  // 只需写入持久化存储
+    invalid,       // 不合法，跳过
+};
+
+// 修改计划中的一项，由plan_prop生成，apply_prop直接执行而不必重新查找和判断
+struct plan_entry {
+    std::string name;
+    std::string value;
+    std::string old;          // 修改前的值，属性不存在时为空
+    plan_op op = plan_op::invalid;
+    bool direct = false;      // 是否绕过property_service
+    bool persist = false;     // 是否需要写入持久化存储
+    size_t bytes = 0;         // 预计在属性区域中新分配的字节数
+    prop_info *pi = nullptr;  // 已存在的属性节点
+    const char *reason = nullptr;  // 不合法的原因
+};
+
+// 批量输入中不合法的属性
+struct prop_error {
+    std::string name;
+    const char *reason;
+};
+
+// 流水线中传递的一条已检查过的属性
+struct stream_record {
+    std::string name;
+    std::string value;
+};
+
+// 属性匹配器：多个模式中任意一个匹配即可。
+// 默认按子串匹配，首字节用memchr（libc的向量化实现）定位；-E时按POSIX扩展正则匹配
+struct prop_matcher {
+    prop_matcher() = default;
+    DISALLOW_COPY_AND_MOVE(prop_matcher)
+    ~prop_matcher() {
+        for (auto &re : regexes)
+            regfree(&re);
+    }
+
+    void add(const char *pattern) { patterns.emplace_back(pattern); }
+    bool empty() const { return patterns.empty(); }
+
+    // 编译正则表达式，模式不合法时返回false
+    bool compile(bool regex) {
+        if (!regex)
+            return true;
+        regexes.resize(patterns.size());
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            if (regcomp(&regexes[i], patterns[i].data(), REG_EXTENDED | REG_NOSUB)) {
+                fprintf(stderr, "Invalid regex: [%s]\n", patterns[i].data());
+                regexes.resize(i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool match(const char *s) const {
+        if (patterns.empty())
+            return true;
+        if (!regexes.empty()) {
+            for (auto &re : regexes) {
+                if (regexec(&re, s, 0, nullptr, 0) == 0)
+                    return true;
+            }
+            return false;
+        }
+        std::string_view sv(s);
+        for (auto &p : patterns) {
+            if (find(sv, p))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    static bool find(std::string_view s, std::string_view p) {
+        if (p.empty())
+            return true;
+        if (s.size() < p.size())
+            return false;
+        const char *cur = s.data();
+        const char *last = s.data() + s.size() - p.size();
+        while (cur <= last) {
+            cur = static_cast<const char *>(memchr(cur, p[0], last - cur + 1));
+            if (cur == nullptr)
+                return false;
+            if (memcmp(cur + 1, p.data() + 1, p.size() - 1) == 0)
+                return true;
+            ++cur;
+        }
+        return false;
+    }
+
+    std::vector<std::string> patterns;
+    std::vector<regex_t> regexes;
+};
+
+// 属性名称和值的检查，合法时返回nullptr，否则返回原因
+const char *check_prop_name(std::string_view name);
+const char *check_prop_value(std::string_view name, std::string_view value);
+bool check_legal_property_name(const char *name);
+
+void InitOnce();  // 加载平台实现并初始化系统属性
+
+// 单个属性的读写
+std::string get_prop(const char *name, PropFlags flags);
+int set_prop(const char *name, const char *value, PropFlags flags);
+int delete_prop(const char *name, PropFlags flags);
+// 打印所有（匹配的）属性，过滤时没有匹配的属性返回1
+int print_props(PropFlags flags, const prop_matcher &names, const prop_matcher &values);
+
+// 修改计划：store为nullptr时不读取持久化存储，checked表示名称和值已经检查过
+plan_entry plan_prop(std::string name, std::string value, PropFlags flags,
+                     const prop_list *store, bool checked = false);
+std::vector<plan_entry> plan_props(std::vector<std::pair<std::string, std::string>> &entries,
+                                   PropFlags flags, bool checked = false);
+int apply_plan(const std::vector<plan_entry> &plan, PropFlags flags);  // 返回设置失败的属性数
+
+// 批量加载，返回设置失败的属性数
+int load_files(const std::vector<const char *> &paths, PropFlags flags, bool plan_only = false,
+               const char *checkpoint = nullptr);
+size_t stream_props(FILE *fp, const std::function<void(stream_record &)> &apply,
+                    const std::function<void()> &idle, std::vector<prop_error> &errors);
+int load_stream(PropFlags flags);
+int rollback(const char *name);
+
+// 预编译的属性包
+int compile_bundle(const std::vector<const char *> &paths, const char *out);
+int apply_bundle(const char *path, PropFlags flags);
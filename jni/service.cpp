@@ -0,0 +1,140 @@
+// property_service流水线提交实现
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "logging.h"
+#include "resetprop.hpp"
+
+using namespace std;
+
+// 来源：bionic/libc/bionic/system_property_set.cpp
+#define PROP_MSG_SETPROP2   0x00020001
+#define PROP_SUCCESS        0
+
+// 连接到property_service并发送一次SETPROP2请求，返回套接字
+static int svc_send(const char *socket_path, const string &name, const string &value) {
+    int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_LOCAL;
+    strscpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+    if (connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // 格式：命令字 | 名称长度 | 名称 | 值长度 | 值
+    uint32_t cmd = PROP_MSG_SETPROP2;
+    uint32_t name_len = name.length();
+    uint32_t value_len = value.length();
+    iovec iov[] = {
+        { &cmd, sizeof(cmd) },
+        { &name_len, sizeof(name_len) },
+        { (void *) name.data(), name_len },
+        { &value_len, sizeof(value_len) },
+        { (void *) value.data(), value_len },
+    };
+    ssize_t total = sizeof(cmd) + sizeof(name_len) + name_len + sizeof(value_len) + value_len;
+    if (writev(fd, iov, sizeof(iov) / sizeof(iov[0])) != total) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 读取property_service的应答并关闭套接字
+static int svc_recv(int fd) {
+    int32_t result = -1;
+    if (recv(fd, &result, sizeof(result), MSG_WAITALL) != sizeof(result))
+        result = -1;
+    close(fd);
+    return result == PROP_SUCCESS ? 0 : (result ?: -1);
+}
+
+// 同时保持多个请求在途，同名属性的请求严格按顺序完成
+int svc_set_props(vector<svc_request> &reqs, const char *socket_path, int window) {
+    struct inflight {
+        int fd;
+        size_t idx;
+    };
+    vector<inflight> pending;
+    vector<pollfd> pfds;
+
+    // 等待至少一个在途请求完成，poll出错时返回false
+    auto drain_one = [&]() -> bool {
+        pfds.clear();
+        for (auto &p : pending)
+            pfds.push_back({ p.fd, POLLIN, 0 });
+        int r;
+        while ((r = poll(pfds.data(), pfds.size(), -1)) < 0 && errno == EINTR);
+        if (r < 0)
+            return false;
+        for (size_t i = pfds.size(); i-- > 0;) {
+            if (pfds[i].revents == 0)
+                continue;
+            reqs[pending[i].idx].ret = svc_recv(pending[i].fd);
+            pending.erase(pending.begin() + i);
+        }
+        return true;
+    };
+    auto is_inflight = [&](const string &name) {
+        for (auto &p : pending) {
+            if (reqs[p.idx].name == name)
+                return true;
+        }
+        return false;
+    };
+
+    bool ok = true;
+    size_t i = 0;
+    for (; i < reqs.size(); ++i) {
+        auto &r = reqs[i];
+        // 保证同名属性的前一个请求已经完成，需要删除时所有请求都已完成
+        while (ok && !pending.empty() &&
+               (r.recreate || pending.size() >= window || is_inflight(r.name)))
+            ok = drain_one();
+        if (!ok)
+            break;
+        // 与set_prop相同，只读属性需先删除才能重新设置
+        if (r.recreate && __system_property_find(r.name.data()))
+            __system_property_delete(r.name.data(), false);
+        int fd = svc_send(socket_path, r.name, r.value);
+        if (fd < 0) {
+            r.ret = -1;
+            continue;
+        }
+        pending.push_back({ fd, i });
+    }
+    while (ok && !pending.empty())
+        ok = drain_one();
+    if (!ok) {
+        // 无法再等待应答，在途和尚未发送的请求都视为失败
+        LOGE("resetprop: poll property_service: %s\n", strerror(errno));
+        for (auto &p : pending) {
+            close(p.fd);
+            reqs[p.idx].ret = -1;
+        }
+        pending.clear();
+        for (; i < reqs.size(); ++i)
+            reqs[i].ret = -1;
+    }
+
+    int failed = 0;
+    for (auto &r : reqs) {
+        if (r.ret) {
+            LOGW("resetprop: set prop [%s] by property_service error: %d\n", r.name.data(), r.ret);
+            ++failed;
+        }
+    }
+    LOGD("resetprop: %zu props submitted to property_service, %d failed\n", reqs.size(), failed);
+    return failed;
+}